@@ -0,0 +1,238 @@
+#include "arbfn_columns.h"
+#include "atom.h"
+#include "error.h"
+#include "group.h"
+#include "lammps.h"
+#include "neighbor.h"
+#include <algorithm>
+
+std::vector<AtomColumn>
+LAMMPS_NS::resolve_columns(class LAMMPS *_lmp, const std::string &_fix_name,
+                           const Handshake &_handshake, const bool &_is_dipole)
+{
+  Atom *const atom = _lmp->atom;
+  Error *const error = _lmp->error;
+
+  std::vector<std::string> fields = _handshake.fields;
+  if (fields.empty()) { fields = default_fields(_is_dipole); }
+  sort_fields(fields);
+
+  std::vector<AtomColumn> out;
+  for (const auto &name : fields) {
+    AtomColumn column = make_column(name);
+
+    if (column.field == 0) {
+      error->universe_one(FLERR, "`fix " + _fix_name + "' controller requested unknown field `" +
+                              name + "'.");
+    } else if (column.field == ARBFN_FIELD_MU && !atom->mu_flag) {
+      error->universe_one(FLERR, "`fix " + _fix_name + "' controller requested `mu', but atoms "
+                              "have no dipole moments.");
+    } else if (column.field == ARBFN_FIELD_Q && !atom->q_flag) {
+      error->universe_one(FLERR, "`fix " + _fix_name + "' controller requested `q', but atoms "
+                              "have no charges.");
+    } else if (column.field == ARBFN_FIELD_TAG && !atom->tag_enable) {
+      error->universe_one(FLERR, "`fix " + _fix_name + "' controller requested `tag', but atom "
+                              "IDs are disabled.");
+    } else if (column.field == ARBFN_FIELD_CUSTOM) {
+      int flag, cols;
+      column.custom_index = atom->find_custom(name.c_str() + 2, flag, cols);
+      if (column.custom_index < 0 || cols != 0 || flag != (column.is_integer ? 0 : 1)) {
+        error->universe_one(FLERR, "`fix " + _fix_name + "' controller requested `" + name +
+                                "', which is not a per-atom vector from `fix property/atom'.");
+      }
+    }
+
+    out.push_back(column);
+  }
+
+  return out;
+}
+
+size_t LAMMPS_NS::pack_columns(class LAMMPS *_lmp, const int &_groupbit,
+                               std::vector<AtomColumn> &_columns, std::vector<int> &_indices,
+                               const bool &_in_place)
+{
+  Atom *const atom = _lmp->atom;
+  const int *const mask = atom->mask;
+
+  _indices.clear();
+  for (int i = 0; i < atom->nlocal; ++i) {
+    if (mask[i] & _groupbit) { _indices.push_back(i); }
+  }
+  return pack_columns(_lmp, _columns, _indices, _in_place);
+}
+
+bool LAMMPS_NS::group_indices(class LAMMPS *_lmp, const int &_igroup, std::vector<int> &_indices,
+                              bigint &_built)
+{
+  // Dynamic groups (`group ... dynamic`) change members between builds, so are listed every time
+  Group *const group = _lmp->group;
+  const bigint lastcall = _lmp->neighbor->lastcall;
+  if (!group->dynamic[_igroup] && _built >= 0 && _built == lastcall) { return false; }
+
+  Atom *const atom = _lmp->atom;
+  const int *const mask = atom->mask;
+  const int groupbit = group->bitmask[_igroup];
+  _indices.clear();
+  for (int i = 0; i < atom->nlocal; ++i) {
+    if (mask[i] & groupbit) { _indices.push_back(i); }
+  }
+  _built = lastcall;
+  return true;
+}
+
+size_t LAMMPS_NS::pack_columns(class LAMMPS *_lmp, std::vector<AtomColumn> &_columns,
+                               const std::vector<int> &_indices, const bool &_in_place,
+                               const int &_threads)
+{
+  Atom *const atom = _lmp->atom;
+  const size_t n = _indices.size();
+
+  for (auto &column : _columns) {
+    // Pick the source array once per column
+    const double *const *vectors = nullptr;
+    const double *scalars = nullptr;
+    unsigned int stride = 3;
+    switch (column.field) {
+      case ARBFN_FIELD_X:
+        vectors = atom->x;
+        break;
+      case ARBFN_FIELD_V:
+        vectors = atom->v;
+        break;
+      case ARBFN_FIELD_F:
+        vectors = atom->f;
+        break;
+      case ARBFN_FIELD_MU:
+        // The fourth component is the magnitude, which is not sent
+        vectors = atom->mu;
+        stride = 4;
+        break;
+      case ARBFN_FIELD_Q:
+        scalars = atom->q;
+        stride = 1;
+        break;
+    }
+
+    if (_in_place && (vectors != nullptr || scalars != nullptr)) {
+      column.source = vectors != nullptr ? (n > 0 ? vectors[0] : nullptr) : scalars;
+      column.stride = stride;
+      column.index = _indices.data();
+      column.values.clear();
+      continue;
+    }
+
+    column.source = nullptr;
+    column.values.resize(column.width * n);
+    double *const values = column.values.data();
+
+    // Each atom is copied on its own, so the threads never share a value
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(_threads) if (_threads > 1) schedule(static)
+#else
+    (void) _threads;
+#endif
+    for (long j = 0; j < (long) n; ++j) {
+      const int i = _indices[j];
+      double *const out = values + j * column.width;
+      if (vectors != nullptr) {
+        out[0] = vectors[i][0];
+        out[1] = vectors[i][1];
+        out[2] = vectors[i][2];
+      } else if (scalars != nullptr) {
+        out[0] = scalars[i];
+      } else if (column.field == ARBFN_FIELD_TYPE) {
+        out[0] = atom->type[i];
+      } else if (column.field == ARBFN_FIELD_TAG) {
+        out[0] = atom->tag[i];
+      } else if (column.is_integer) {
+        out[0] = atom->ivector[column.custom_index][i];
+      } else {
+        out[0] = atom->dvector[column.custom_index][i];
+      }
+    }
+  }
+
+  return n;
+}
+
+size_t LAMMPS_NS::gather_columns(MPI_Comm &_node, const size_t &_n,
+                                 const std::vector<AtomColumn> &_columns, NodeGather &_gather)
+{
+  int node_rank, node_size;
+  MPI_Comm_rank(_node, &node_rank);
+  MPI_Comm_size(_node, &node_size);
+
+  // Each rank sends its columns to the leader one after another
+  size_t width = 0;
+  for (const auto &column : _columns) { width += column.width; }
+  _gather.outgoing.resize(width * _n);
+  double *out = _gather.outgoing.data();
+  for (const auto &column : _columns) {
+    out = std::copy(column.values.begin(), column.values.end(), out);
+  }
+
+  if (node_rank == 0) {
+    _gather.counts.resize(node_size);
+    _gather.offsets.resize(node_size);
+    _gather.block_counts.resize(node_size);
+    _gather.block_displs.resize(node_size);
+  }
+  const int count = _n;
+  MPI_Gather(&count, 1, MPI_INT, _gather.counts.data(), 1, MPI_INT, 0, _node);
+
+  size_t total = 0;
+  if (node_rank == 0) {
+    for (int r = 0; r < node_size; ++r) {
+      _gather.offsets[r] = total;
+      _gather.block_counts[r] = width * _gather.counts[r];
+      _gather.block_displs[r] = width * total;
+      total += _gather.counts[r];
+    }
+    _gather.gathered.resize(width * total);
+  }
+  MPI_Gatherv(_gather.outgoing.data(), width * _n, MPI_DOUBLE, _gather.gathered.data(),
+              _gather.block_counts.data(), _gather.block_displs.data(), MPI_DOUBLE, 0, _node);
+  if (node_rank != 0) { return 0; }
+
+  // Reassemble the columns of the whole node, rank after rank
+  size_t start = 0;
+  for (auto &column : _gather.merged) {
+    column.values.resize(column.width * total);
+    for (int r = 0; r < node_size; ++r) {
+      const double *const from =
+          _gather.gathered.data() + _gather.block_displs[r] + start * _gather.counts[r];
+      std::copy(from, from + column.width * _gather.counts[r],
+                column.values.begin() + column.width * _gather.offsets[r]);
+    }
+    start += column.width;
+  }
+  return total;
+}
+
+void LAMMPS_NS::share_handshake(MPI_Comm &_node, Handshake &_handshake)
+{
+  int node_rank;
+  MPI_Comm_rank(_node, &node_rank);
+
+  // The leader's fields are sent as one space-separated string
+  std::string fields;
+  int sizes[2] = {(int) _handshake.format, 0};
+  if (node_rank == 0) {
+    for (const auto &field : _handshake.fields) { fields += field + " "; }
+    sizes[1] = fields.size();
+  }
+
+  MPI_Bcast(sizes, 2, MPI_INT, 0, _node);
+  fields.resize(sizes[1]);
+  if (sizes[1] > 0) { MPI_Bcast(&fields[0], sizes[1], MPI_CHAR, 0, _node); }
+  if (node_rank == 0) { return; }
+
+  _handshake.format = (WireFormat) sizes[0];
+  _handshake.fields.clear();
+  size_t start = 0;
+  for (size_t end = fields.find(' '); end != std::string::npos; end = fields.find(' ', start)) {
+    _handshake.fields.push_back(fields.substr(start, end - start));
+    start = end + 1;
+  }
+}
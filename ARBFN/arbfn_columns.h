@@ -0,0 +1,135 @@
+/* -*- c++ -*- ----------------------------------------------------------
+    LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+    https://www.lammps.org/, Sandia National Laboratories
+    LAMMPS development team: developers@lammps.org
+
+    Copyright (2003) Sandia Corporation.  Under the terms of Contract
+    DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+    certain rights in this software.  This software is distributed under
+    the GNU General Public License.
+
+    See the README file in the top-level LAMMPS directory.
+-------------------------------------------------------------------------
+    Moves per-atom LAMMPS data into the columns sent to ARBFN
+    controllers, and between the ranks of a node. Shared by
+    `fix arbfn` and `fix arbfn/ffield`. Based on work funded by NSF
+    grant 2126451 at Colorado Mesa University.
+
+    J Dehmel, J Schiffbauer, 2024/2025
+------------------------------------------------------------------------- */
+
+#ifndef ARBFN_COLUMNS_HPP
+#define ARBFN_COLUMNS_HPP
+
+#include "interchange.h"
+#include "pointers.h"
+#include <string>
+#include <vector>
+
+namespace LAMMPS_NS {
+/**
+ * @struct NodeGather
+ * @brief The buffers used to gather the columns of every rank on
+ * a node onto its leader (see gather_columns), kept between steps
+ * so that doing so does not allocate
+ */
+struct NodeGather {
+  /// On the leader, the number of atoms from each rank on the node
+  std::vector<int> counts;
+
+  /// On the leader, the index of each rank's first atom in `merged`
+  std::vector<uint64_t> offsets;
+
+  /// On the leader, the number of doubles to and from each rank on the node
+  std::vector<int> block_counts;
+
+  /// On the leader, where each rank's doubles start
+  std::vector<int> block_displs;
+
+  /// This rank's columns, one after another, as sent to the leader
+  std::vector<double> outgoing;
+
+  /// On the leader, every rank's block of columns (free for other uses afterwards)
+  std::vector<double> gathered;
+
+  /// On the leader, the columns of the whole node. Must be given the same fields as the columns
+  /// gathered before the first gather.
+  std::vector<AtomColumn> merged;
+};
+
+/**
+ * @brief Builds the columns for the fields a controller asked for, ensuring that each is
+ * available in this simulation. Errors out via LAMMPS if one is not.
+ * @param _lmp The LAMMPS instance to check against
+ * @param _fix_name The style name of the calling fix, used in error messages
+ * @param _handshake The negotiated settings. If it does not name any fields, the defaults are used.
+ * @param _is_dipole True iff the defaults should include mu
+ * @returns The (empty) columns in wire order
+ */
+std::vector<AtomColumn> resolve_columns(class LAMMPS *_lmp, const std::string &_fix_name,
+                                        const Handshake &_handshake, const bool &_is_dipole);
+
+/**
+ * @brief Fills the columns with the data of all local atoms in the given group
+ * @param _lmp The LAMMPS instance to read from
+ * @param _groupbit The bitmask of the group to send
+ * @param _columns The columns to fill, as given by resolve_columns
+ * @param _indices Where to save the local index of each atom packed
+ * @param _in_place If true, columns stored as doubles by LAMMPS (x, v, f, mu and q) are not
+ * copied, but point into the LAMMPS arrays instead (see AtomColumn::source). These are only
+ * valid until the arrays next change.
+ * @returns The number of atoms packed
+ */
+size_t pack_columns(class LAMMPS *_lmp, const int &_groupbit, std::vector<AtomColumn> &_columns,
+                    std::vector<int> &_indices, const bool &_in_place = false);
+
+/**
+ * @brief Lists the local atoms in the given group, unless the list is still current: Atoms
+ * only change ranks or order when the neighbor lists are rebuilt. Group membership can change
+ * at any step too, but only for dynamic groups, which are listed every call.
+ * @param _lmp The LAMMPS instance to read from
+ * @param _igroup The index of the group
+ * @param _indices Where to save the local index of each atom in the group
+ * @param _built The timestep of the neighbor list build `_indices` was listed after, or -1 if
+ * it was never listed. This is updated.
+ * @returns True iff the list was rebuilt
+ */
+bool group_indices(class LAMMPS *_lmp, const int &_igroup, std::vector<int> &_indices,
+                   bigint &_built);
+
+/**
+ * @brief Fills the columns with the data of the given local atoms
+ * @param _lmp The LAMMPS instance to read from
+ * @param _columns The columns to fill, as given by resolve_columns
+ * @param _indices The local index of each atom to pack
+ * @param _in_place As above
+ * @param _threads The number of OpenMP threads to copy with (if built with OpenMP)
+ * @returns The number of atoms packed
+ */
+size_t pack_columns(class LAMMPS *_lmp, std::vector<AtomColumn> &_columns,
+                    const std::vector<int> &_indices, const bool &_in_place = false,
+                    const int &_threads = 1);
+
+/**
+ * @brief Gathers the columns of every rank on a node into `_gather.merged` on its leader (rank
+ * 0 of `_node`), one rank's atoms after another. Collective over `_node`.
+ * @param _node The ranks sharing this node
+ * @param _n The number of atoms in `_columns` on this rank
+ * @param _columns This rank's columns, packed by pack_columns (not in place)
+ * @param _gather The buffers to gather with. `counts` and `offsets` give where each rank's atoms
+ * ended up.
+ * @returns On the leader, the number of atoms on the whole node. Elsewhere, 0.
+ */
+size_t gather_columns(MPI_Comm &_node, const size_t &_n, const std::vector<AtomColumn> &_columns,
+                      NodeGather &_gather);
+
+/**
+ * @brief Gives every rank on a node the settings its leader (rank 0 of `_node`) negotiated.
+ * Collective over `_node`.
+ * @param _node The ranks sharing this node
+ * @param _handshake The leader's settings, or where to save them
+ */
+void share_handshake(MPI_Comm &_node, Handshake &_handshake);
+}    // namespace LAMMPS_NS
+
+#endif    // ARBFN_COLUMNS_HPP
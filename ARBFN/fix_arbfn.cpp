@@ -1,7 +1,17 @@
 #include "fix_arbfn.h"
+#include "arbfn_columns.h"
+#include "domain.h"
 #include "interchange.h"
+#include "memory.h"
+#include "neighbor.h"
 #include "utils.h"
+#include <algorithm>
+#include <cstring>
 #include <mpi.h>
+#include <string>
+
+/// The doubles per atom in the cache: x, y, z, dfx, dfy, dfz, then whether it is valid
+const static int CACHE_WIDTH = 7;
 
 LAMMPS_NS::FixArbFn::FixArbFn(class LAMMPS *_lmp, int _c, char **_v) : Fix(_lmp, _c, _v)
 {
@@ -29,6 +39,60 @@ LAMMPS_NS::FixArbFn::FixArbFn(class LAMMPS *_lmp, int _c, char **_v) : Fix(_lmp,
       ++i;
     } else if (strcmp(arg, "dipole") == 0) {
       is_dipole = !is_dipole;
+    } else if (strcmp(arg, "split") == 0) {
+      split = true;
+    } else if (strcmp(arg, "lag") == 0) {
+      if (i + 1 >= _c) {
+        error->universe_one(FLERR, "Malformed `fix arbfn': Missing argument for `lag'.");
+      }
+      const int k = utils::inumeric(FLERR, _v[i + 1], false, _lmp);
+      if (k < 0) { error->universe_one(FLERR, "Malformed `fix arbfn': `lag' must be >= 0."); }
+      lag = k;
+      ++i;
+    } else if (strcmp(arg, "waitmode") == 0) {
+      if (i + 1 >= _c) {
+        error->universe_one(FLERR, "Malformed `fix arbfn': Missing argument for `waitmode'.");
+      }
+      if (!wait_mode_from_name(_v[i + 1], wait)) {
+        error->universe_one(FLERR, "Malformed `fix arbfn': Unknown `waitmode' `" +
+                                std::string(_v[i + 1]) + "'.");
+      }
+      ++i;
+    } else if (strcmp(arg, "aggregate") == 0) {
+      if (i + 1 >= _c) {
+        error->universe_one(FLERR, "Malformed `fix arbfn': Missing argument for `aggregate'.");
+      }
+      if (strcmp(_v[i + 1], "node") == 0) {
+        aggregate = true;
+      } else if (strcmp(_v[i + 1], "none") == 0) {
+        aggregate = false;
+      } else {
+        error->universe_one(FLERR, "Malformed `fix arbfn': Unknown `aggregate' mode `" +
+                                std::string(_v[i + 1]) + "'.");
+      }
+      ++i;
+    } else if (strcmp(arg, "skin") == 0) {
+      if (i + 1 >= _c) {
+        error->universe_one(FLERR, "Malformed `fix arbfn': Missing argument for `skin'.");
+      }
+      skin = utils::numeric(FLERR, _v[i + 1], false, _lmp);
+      if (skin < 0.0) { error->universe_one(FLERR, "Malformed `fix arbfn': `skin' must be >= 0."); }
+      ++i;
+    } else if (strcmp(arg, "shard") == 0) {
+      if (i + 1 >= _c) {
+        error->universe_one(FLERR, "Malformed `fix arbfn': Missing argument for `shard'.");
+      }
+      if (strcmp(_v[i + 1], "rank") == 0) {
+        shard = SHARD_RANK;
+      } else if (strcmp(_v[i + 1], "space") == 0) {
+        shard = SHARD_SPACE;
+      } else if (strcmp(_v[i + 1], "none") == 0) {
+        shard = SHARD_NONE;
+      } else {
+        error->universe_one(FLERR, "Malformed `fix arbfn': Unknown `shard' mode `" +
+                                std::string(_v[i + 1]) + "'.");
+      }
+      ++i;
     }
 
     else {
@@ -36,96 +100,417 @@ LAMMPS_NS::FixArbFn::FixArbFn(class LAMMPS *_lmp, int _c, char **_v) : Fix(_lmp,
                           "Malformed `fix arbfn': Unknown keyword `" + std::string(arg) + "'.");
     }
   }
+
+  // The cache migrates with the atoms
+  if (skin > 0.0) {
+    maxexchange = CACHE_WIDTH;
+    create_attribute = 1;
+    grow_arrays(atom->nmax);
+    atom->add_callback(Atom::GROW);
+  }
+
+  // Group the ranks which share memory, keeping their order from world
+  if (aggregate) {
+    MPI_Comm_split_type(world, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &node_rank);
+    MPI_Comm_size(node, &node_size);
+  }
 }
 
 LAMMPS_NS::FixArbFn::~FixArbFn()
 {
-  send_deregistration(controller_rank, comm);
+  drain();
+  free_exchange(exchange);
+  if (node_rank == 0) { send_deregistration(controller_rank, comm, handshake); }
+  if (node != MPI_COMM_NULL) { MPI_Comm_free(&node); }
+  if (skin > 0.0) {
+    atom->delete_callback(id, Atom::GROW);
+    memory->destroy(cache);
+  }
   MPI_Comm_free(&comm);
 }
 
 void LAMMPS_NS::FixArbFn::init()
 {
-  bool res = send_registration(controller_rank, comm);
-  if (!res) {
+  // Lagged and split-phase responses are matched to atoms by ID
+  if ((lag > 0 || split) && (!atom->tag_enable || atom->map_style == Atom::MAP_NONE)) {
     error->universe_one(FLERR,
-                        "`fix arbfn' failed to register with controller: Ensure it is running.");
+                        "`fix arbfn' `lag' and `split' require atom IDs and an atom map.");
+  }
+  if (skin > 0.0 && (lag > 0 || split)) {
+    error->universe_one(FLERR, "`fix arbfn' `skin' cannot be used with `lag' or `split'.");
+  }
+  if (aggregate && (lag > 0 || split)) {
+    error->universe_one(FLERR, "`fix arbfn' `aggregate' cannot be used with `lag' or `split'.");
+  }
+
+  // Responses to the last run are not applied to this one
+  drain();
+  free_exchange(exchange);
+
+  // Where this worker falls among all workers, which picks its controller when sharded
+  double where = -1.0;
+  if (shard == SHARD_RANK) {
+    int me, nprocs;
+    MPI_Comm_rank(world, &me);
+    MPI_Comm_size(world, &nprocs);
+    where = (double) me / nprocs;
+  } else if (shard == SHARD_SPACE) {
+    const double center = 0.5 * (domain->sublo[0] + domain->subhi[0]);
+    where = std::max((center - domain->boxlo[0]) / domain->prd[0], 0.0);
+  }
+
+  // Collectives need every worker in lockstep, which lagged, split and aggregated requests lack
+  const bool offer_collective = lag == 0 && !split && !aggregate && shard == SHARD_NONE;
+
+  // When aggregating, only the leader of each node registers. A collective controller is already
+  // waiting in its next gather, so later runs keep the first handshake.
+  if (node_rank == 0 && !handshake.collective) {
+    bool res = send_registration(controller_rank, comm, handshake, world, where, offer_collective);
+    if (!res) {
+      error->universe_one(FLERR,
+                          "`fix arbfn' failed to register with controller: Ensure it is running.");
+    }
+  }
+  if (aggregate) { share_handshake(node, handshake); }
+
+  // With a skin, only some atoms are sent, so the controller is told which
+  Handshake wanted = handshake;
+  if (skin > 0.0) {
+    if (wanted.fields.empty()) { wanted.fields = default_fields(is_dipole); }
+    if (std::find(wanted.fields.begin(), wanted.fields.end(), "tag") == wanted.fields.end()) {
+      wanted.fields.push_back("tag");
+    }
+
+    // Deltas from the last run are not reused in this one
+    for (int i = 0; i < atom->nlocal; ++i) { cache[i][6] = 0.0; }
+  }
+  columns = resolve_columns(lmp, "arbfn", wanted, is_dipole);
+  if (aggregate && node_rank == 0) { gather.merged = columns; }
+
+  // Forces are not ready when a split-phase request is sent
+  if (split) {
+    for (size_t i = 0; i < columns.size(); ++i) {
+      if (columns[i].field != ARBFN_FIELD_F) { continue; }
+      if (!handshake.fields.empty()) {
+        error->universe_one(FLERR, "`fix arbfn' controller requested `f', which `split' "
+                                   "cannot send.");
+      }
+      columns.erase(columns.begin() + i);
+      break;
+    }
   }
 
   counter = 0;
+  posted = false;
+  members_built = -1;
 }
 
-void LAMMPS_NS::FixArbFn::post_force(int)
+bool LAMMPS_NS::FixArbFn::is_due()
 {
   // Only actually post force every once in a while
   ++counter;
   if (counter < every) {
-    return;
+    return false;
   } else {
     // Reset counter and do interchange
     counter = 0;
+    return true;
   }
+}
+
+void LAMMPS_NS::FixArbFn::post_integrate()
+{
+  // Positions and velocities are final here, so the controller can work during the pair style
+  posted = is_due();
+  if (posted) { post(); }
+}
 
-  // Meta
+void LAMMPS_NS::FixArbFn::post_force(int)
+{
+  if (split) {
+    if (!posted) { return; }
+    posted = false;
+  } else if (!is_due()) {
+    return;
+  } else if (lag > 0) {
+    post();
+  }
+
+  if (split || lag > 0) {
+    // Warm-up: No force is applied until `lag` requests are in flight
+    if (in_flight.size() > lag) { apply_oldest(); }
+    return;
+  } else if (aggregate) {
+    aggregated_interchange();
+    return;
+  }
+
+  // Move only the requested fields from LAMMPS into the columns. The binary format reads them
+  // straight from the LAMMPS arrays into its request buffer.
+  const bool in_place = handshake.format == ARBFN_FORMAT_BINARY;
+  const size_t n = pack(in_place);
+
+  // Transmit atoms, receive fix data. In steady state, this reuses the same MPI requests.
+  deltas.resize(3 * n);
+  if (!persistent_interchange(n, columns, deltas.data(), max_ms, controller_rank, comm, handshake,
+                              exchange, wait)) {
+    error->universe_one(FLERR, "`fix arbfn' failed interchange.");
+  }
+
+  // The controller may change how often it is called
+  if (exchange.every != 0) { every = exchange.every; }
+  add_deltas(n);
+}
+
+size_t LAMMPS_NS::FixArbFn::pack(const bool &_in_place)
+{
+  group_indices(lmp, igroup, members, members_built);
+  if (skin <= 0.0) { return pack_columns(lmp, columns, members, _in_place); }
+
+  // Like a neighbor list skin: Atoms are only sent again once they move far enough
   const double *const *const x = atom->x;
-  const double *const *const v = atom->v;
-  const double *const *const mu = atom->mu;
-  const int *const mask = atom->mask;
+  const double skin_sq = skin * skin;
+  indices.clear();
+  for (const int i : members) {
+    const double *const entry = cache[i];
+    const double dx = x[i][0] - entry[0];
+    const double dy = x[i][1] - entry[1];
+    const double dz = x[i][2] - entry[2];
+    if (entry[6] == 0.0 || dx * dx + dy * dy + dz * dz > skin_sq) { indices.push_back(i); }
+  }
+  return pack_columns(lmp, columns, indices, _in_place);
+}
 
+void LAMMPS_NS::FixArbFn::add_deltas(const size_t &_n)
+{
+  // Add the force deltas into LAMMPS
   double *const *const f = atom->f;
+  const double *const dfx = deltas.data();
+  const double *const dfy = dfx + _n;
+  const double *const dfz = dfy + _n;
+  if (skin <= 0.0) {
+    for (size_t j = 0; j < _n; ++j) {
+      const int i = members[j];
+      f[i][0] += dfx[j];
+      f[i][1] += dfy[j];
+      f[i][2] += dfz[j];
+    }
+    return;
+  }
 
-  // Variables
-  bool success;
-  std::vector<AtomData> to_send;
-
-  // Move from LAMMPS atom format to AtomData struct
-  size_t n = 0;
-  for (size_t i = 0; i < atom->nlocal; ++i) {
-    if (mask[i] & groupbit) {
-      AtomData to_add;
-      to_add.x = x[i][0];
-      to_add.y = x[i][1];
-      to_add.z = x[i][2];
-      to_add.vx = v[i][0];
-      to_add.vy = v[i][1];
-      to_add.vz = v[i][2];
-      to_add.fx = f[i][0];
-      to_add.fy = f[i][1];
-      to_add.fz = f[i][2];
-
-      to_add.is_dipole = is_dipole;
-      if (to_add.is_dipole) {
-        to_add.mux = mu[i][0];
-        to_add.muy = mu[i][1];
-        to_add.muz = mu[i][2];
-      }
+  // Remember where each atom sent was, and its delta
+  const double *const *const x = atom->x;
+  for (size_t j = 0; j < _n; ++j) {
+    double *const entry = cache[indices[j]];
+    entry[0] = x[indices[j]][0];
+    entry[1] = x[indices[j]][1];
+    entry[2] = x[indices[j]][2];
+    entry[3] = dfx[j];
+    entry[4] = dfy[j];
+    entry[5] = dfz[j];
+    entry[6] = 1.0;
+  }
+
+  // Then every atom in the group gets its latest delta
+  for (const int i : members) {
+    if (cache[i][6] == 0.0) { continue; }
+    f[i][0] += cache[i][3];
+    f[i][1] += cache[i][4];
+    f[i][2] += cache[i][5];
+  }
+}
+
+void LAMMPS_NS::FixArbFn::grow_arrays(int _nmax)
+{
+  memory->grow(cache, _nmax, CACHE_WIDTH, "arbfn:cache");
+}
+
+void LAMMPS_NS::FixArbFn::copy_arrays(int _i, int _j, int)
+{
+  memcpy(cache[_j], cache[_i], CACHE_WIDTH * sizeof(double));
+}
+
+void LAMMPS_NS::FixArbFn::set_arrays(int _i)
+{
+  // New atoms have never been sent
+  cache[_i][6] = 0.0;
+}
+
+int LAMMPS_NS::FixArbFn::pack_exchange(int _i, double *_buf)
+{
+  memcpy(_buf, cache[_i], CACHE_WIDTH * sizeof(double));
+  return CACHE_WIDTH;
+}
+
+int LAMMPS_NS::FixArbFn::unpack_exchange(int _nlocal, double *_buf)
+{
+  memcpy(cache[_nlocal], _buf, CACHE_WIDTH * sizeof(double));
+  return CACHE_WIDTH;
+}
+
+void LAMMPS_NS::FixArbFn::aggregated_interchange()
+{
+  // Each rank sends its columns to the leader one after another
+  const size_t n = pack(false);
+  const size_t total = gather_columns(node, n, columns, gather);
+
+  if (node_rank == 0) {
+    merged_deltas.resize(3 * total);
+    if (!persistent_interchange(total, gather.merged, merged_deltas.data(), max_ms,
+                                controller_rank, comm, handshake, exchange, wait,
+                                gather.offsets)) {
+      error->universe_one(FLERR, "`fix arbfn' failed interchange.");
+    }
 
-      to_send.push_back(to_add);
-      ++n;
+    // Each rank gets its own dfx, dfy and dfz slices, one after another
+    gather.gathered.resize(3 * total);
+    for (int r = 0; r < node_size; ++r) {
+      for (size_t k = 0; k < 3; ++k) {
+        const double *const from = merged_deltas.data() + k * total + gather.offsets[r];
+        std::copy(from, from + gather.counts[r],
+                  gather.gathered.begin() + 3 * gather.offsets[r] + k * gather.counts[r]);
+      }
+      gather.block_counts[r] = 3 * gather.counts[r];
+      gather.block_displs[r] = 3 * gather.offsets[r];
     }
   }
 
-  // Transmit atoms, receive fix data
-  FixData *to_recv = new FixData[n];
-  success = interchange(n, to_send.data(), to_recv, max_ms, controller_rank, comm);
-  if (!success) { error->universe_one(FLERR, "`fix arbfn' failed interchange."); }
+  deltas.resize(3 * n);
+  MPI_Scatterv(gather.gathered.data(), gather.block_counts.data(), gather.block_displs.data(),
+               MPI_DOUBLE, deltas.data(), 3 * n, MPI_DOUBLE, 0, node);
+
+  // Every rank on the node must keep interchanging on the same steps as its leader
+  uint64_t next = exchange.every;
+  MPI_Bcast(&next, 1, MPI_UINT64_T, 0, node);
+  if (next != 0) { every = next; }
+  add_deltas(n);
+}
+
+void LAMMPS_NS::FixArbFn::post()
+{
+  // Anything read in place is staged by post_request, so it may be read in place here
+  const bool in_place = handshake.format == ARBFN_FORMAT_BINARY;
+  group_indices(lmp, igroup, members, members_built);
+  const size_t n = pack_columns(lmp, columns, members, in_place);
+
+  // Send this step's request without waiting for it
+  in_flight.emplace_back();
+  post_request(n, columns, max_ms, controller_rank, comm, handshake, in_flight.back());
+  in_flight_tags.emplace_back(n);
+  for (size_t j = 0; j < n; ++j) { in_flight_tags.back()[j] = atom->tag[members[j]]; }
+  in_flight_builds.push_back(neighbor->ncalls);
+}
+
+void LAMMPS_NS::FixArbFn::apply_oldest()
+{
+  const size_t n = in_flight.front().n;
+  deltas.resize(3 * n);
+  if (!collect_response(in_flight.front(), deltas.data(), max_ms, controller_rank, comm,
+                        handshake, wait)) {
+    error->universe_one(FLERR, "`fix arbfn' failed interchange.");
+  }
+  if (in_flight.front().every != 0) { every = in_flight.front().every; }
 
-  // Translate FixData struct to LAMMPS force info
-  n = 0;
-  for (size_t i = 0; i < atom->nlocal; ++i) {
-    if (mask[i] & groupbit) {
-      f[i][0] += to_recv[n].dfx;
-      f[i][1] += to_recv[n].dfy;
-      f[i][2] += to_recv[n].dfz;
-      ++n;
+  // Atoms may have moved since the request, so whichever are still here are found by ID
+  double *const *const f = atom->f;
+  const std::vector<tagint> &tags = in_flight_tags.front();
+  const double *const dfx = deltas.data();
+  const double *const dfy = dfx + n;
+  const double *const dfz = dfy + n;
+  moved_tags.clear();
+  moved_deltas.clear();
+  for (size_t j = 0; j < n; ++j) {
+    const int i = atom->map(tags[j]);
+    if (i < 0 || i >= atom->nlocal) {
+      moved_tags.push_back(tags[j]);
+      moved_deltas.insert(moved_deltas.end(), {dfx[j], dfy[j], dfz[j]});
+      continue;
     }
+    f[i][0] += dfx[j];
+    f[i][1] += dfy[j];
+    f[i][2] += dfz[j];
+  }
+
+  // The rest changed ranks when the neighbor lists were built, which every rank does together
+  if (neighbor->ncalls != in_flight_builds.front()) {
+    deliver_moved();
+  } else if (!moved_tags.empty()) {
+    error->warning(FLERR, "`fix arbfn' dropped the deltas of " +
+                              std::to_string(moved_tags.size()) + " atoms which were deleted.");
+  }
+
+  in_flight.pop_front();
+  in_flight_tags.pop_front();
+  in_flight_builds.pop_front();
+}
+
+void LAMMPS_NS::FixArbFn::deliver_moved()
+{
+  // Every rank learns of every moved atom and keeps those it now owns. Only atoms which changed
+  // ranks since their request are sent, which are few.
+  int nprocs, me;
+  MPI_Comm_size(world, &nprocs);
+  MPI_Comm_rank(world, &me);
+  const int count = moved_tags.size();
+  moved_counts.resize(nprocs);
+  moved_displs.resize(nprocs);
+  MPI_Allgather(&count, 1, MPI_INT, moved_counts.data(), 1, MPI_INT, world);
+
+  int total = 0;
+  for (int r = 0; r < nprocs; ++r) {
+    moved_displs[r] = total;
+    total += moved_counts[r];
+  }
+  if (total == 0) { return; }
+
+  all_moved_tags.resize(total);
+  MPI_Allgatherv(moved_tags.data(), count, MPI_LMP_TAGINT, all_moved_tags.data(),
+                 moved_counts.data(), moved_displs.data(), MPI_LMP_TAGINT, world);
+  for (int r = 0; r < nprocs; ++r) {
+    moved_counts[r] *= 3;
+    moved_displs[r] *= 3;
+  }
+  all_moved_deltas.resize(3 * total);
+  MPI_Allgatherv(moved_deltas.data(), 3 * count, MPI_DOUBLE, all_moved_deltas.data(),
+                 moved_counts.data(), moved_displs.data(), MPI_DOUBLE, world);
+
+  double *const *const f = atom->f;
+  int found = 0;
+  for (int j = 0; j < total; ++j) {
+    const int i = atom->map(all_moved_tags[j]);
+    if (i < 0 || i >= atom->nlocal) { continue; }
+    f[i][0] += all_moved_deltas[3 * j];
+    f[i][1] += all_moved_deltas[3 * j + 1];
+    f[i][2] += all_moved_deltas[3 * j + 2];
+    ++found;
+  }
+
+  // Atoms may also have been lost or deleted since
+  int found_total = 0;
+  MPI_Allreduce(&found, &found_total, 1, MPI_INT, MPI_SUM, world);
+  if (found_total < total && me == 0) {
+    error->warning(FLERR, "`fix arbfn' dropped the deltas of " +
+                              std::to_string(total - found_total) + " atoms which no rank owns.");
+  }
+}
+
+void LAMMPS_NS::FixArbFn::drain()
+{
+  while (!in_flight.empty()) {
+    deltas.resize(3 * in_flight.front().n);
+    collect_response(in_flight.front(), deltas.data(), max_ms, controller_rank, comm, handshake,
+                     wait);
+    in_flight.pop_front();
+    in_flight_tags.pop_front();
+    in_flight_builds.pop_front();
   }
-  delete[] to_recv;
 }
 
 int LAMMPS_NS::FixArbFn::setmask()
 {
   int mask = 0;
   mask |= LAMMPS_NS::FixConst::POST_FORCE;
+  if (split) { mask |= LAMMPS_NS::FixConst::POST_INTEGRATE; }
   return mask;
 }
@@ -26,12 +26,15 @@ FixStyle(arbfn,FixArbFn);
 #ifndef FIX_ARBFN_HPP
 #define FIX_ARBFN_HPP
 
+#include "arbfn_columns.h"
 #include "atom.h"
 #include "comm.h"
 #include "error.h"
 #include "fix.h"
 #include "interchange.h"
 
+#include <deque>
+
 namespace LAMMPS_NS {
 /**
  * @class FixArbFn
@@ -50,13 +53,71 @@ class FixArbFn : public Fix {
   /// Finish allocation
   void init() override;
 
+  /// Send the request early (split only)
+  void post_integrate() override;
+
   /// Retrieve and apply force deltas
   void post_force(int) override;
 
   /// Tell LAMMPS when to call this fix
   int setmask() override;
 
+  /// Grow the per-atom cache (skin only)
+  void grow_arrays(int) override;
+
+  /// Copy one atom's cache entry to another (skin only)
+  void copy_arrays(int, int, int) override;
+
+  /// Mark a newly created atom's cache entry invalid (skin only)
+  void set_arrays(int) override;
+
+  /// Pack an atom's cache entry to migrate with it (skin only)
+  int pack_exchange(int, double *) override;
+
+  /// Unpack a migrating atom's cache entry (skin only)
+  int unpack_exchange(int, double *) override;
+
+  /// How the workers are split between several controllers
+  enum ShardMode {
+    /// Every controller is offered every worker (one controller)
+    SHARD_NONE,
+
+    /// Workers go to controllers in contiguous blocks of ranks
+    SHARD_RANK,
+
+    /// Workers go to controllers by where their subdomain is along x
+    SHARD_SPACE
+  };
+
  protected:
+  /// Advance the counter, returning true iff this step interchanges
+  bool is_due();
+
+  /// Send this step's request without awaiting its response
+  void post();
+
+  /// Receive the oldest response in flight and apply it by atom ID, on whichever rank now owns
+  /// each atom
+  void apply_oldest();
+
+  /// Send the deltas in `moved_tags` and `moved_deltas`, whose atoms this rank no longer owns,
+  /// to every rank, and add those of the atoms this rank now owns. Warns about atoms no rank
+  /// owns. Collective over `world`.
+  void deliver_moved();
+
+  /// Receive and discard the responses to any lagged requests
+  void drain();
+
+  /// Pick the atoms to send this step and move their fields into the columns
+  size_t pack(const bool &_in_place);
+
+  /// Interchange through this node's leader, which sends one request for the whole node
+  void aggregated_interchange();
+
+  /// Add the force deltas in `deltas` to the `n` atoms last packed (and, with a skin, the
+  /// cached deltas to every other atom)
+  void add_deltas(const size_t &_n);
+
   /// The MPI rank of the controller
   uint controller_rank;
 
@@ -74,6 +135,95 @@ class FixArbFn : public Fix {
 
   /// True iff we should send mu data
   bool is_dipole = false;
+
+  /// The settings negotiated with the controller
+  Handshake handshake;
+
+  /// How to wait for the controller
+  WaitMode wait = ARBFN_WAIT_SLEEP;
+
+  /// If positive, apply the response to the request from this
+  /// many calls ago instead of awaiting the current one
+  unsigned int lag = 0;
+
+  /// If true, send requests from post_integrate (without forces)
+  /// and receive them in post_force, overlapping the pair style
+  bool split = false;
+
+  /// True iff post_integrate sent a request this step (split)
+  bool posted = false;
+
+  /// How to pick this worker's controller
+  ShardMode shard = SHARD_NONE;
+
+  /// If positive, only atoms which have moved further than this since they were last sent are
+  /// sent, and every other atom reuses its last delta
+  double skin = 0.0;
+
+  /// Per-atom (skin only): The position when last sent, the delta received, and 1 iff valid.
+  /// This migrates with the atom.
+  double **cache = nullptr;
+
+  /// If true, one leader per node talks to the controller on behalf of every rank on that node
+  bool aggregate = false;
+
+  /// The ranks sharing this node (aggregate only)
+  MPI_Comm node = MPI_COMM_NULL;
+
+  /// This rank's position in `node`. Rank 0 is the leader.
+  int node_rank = 0;
+
+  /// The number of ranks in `node`
+  int node_size = 1;
+
+  /// The buffers to gather the node's columns with. On the leader, `gathered` then holds every
+  /// rank's block of deltas.
+  NodeGather gather;
+
+  /// On the leader, the force deltas of the whole node
+  std::vector<double> merged_deltas;
+
+  /// Persistent requests for the usual (blocking) interchange
+  PersistentExchange exchange;
+
+  /// Requests whose responses have not been applied yet
+  std::deque<PendingRequest> in_flight;
+
+  /// The IDs of the atoms in each request in `in_flight`
+  std::deque<std::vector<tagint>> in_flight_tags;
+
+  /// The number of neighbor list builds when each request in `in_flight` was posted. Atoms
+  /// only change ranks when the lists are built.
+  std::deque<bigint> in_flight_builds;
+
+  /// The IDs of the atoms in the oldest response which are no longer on this rank
+  std::vector<tagint> moved_tags;
+
+  /// The (dfx, dfy, dfz) of each atom in `moved_tags`
+  std::vector<double> moved_deltas;
+
+  /// The number of entries, then their offsets, each rank has in the gathered moved atoms
+  std::vector<int> moved_counts, moved_displs;
+
+  /// Every rank's `moved_tags`, then their `moved_deltas`
+  std::vector<tagint> all_moved_tags;
+  std::vector<double> all_moved_deltas;
+
+  /// The per-atom fields the controller asked for
+  std::vector<AtomColumn> columns;
+
+  /// The local index of each atom in the group, as of the neighbor list build at
+  /// `members_built`, or of this call for dynamic groups (see group_indices)
+  std::vector<int> members;
+
+  /// The timestep `members` was listed at, or -1 to list it again
+  bigint members_built = -1;
+
+  /// The local index of each atom sent, with a skin
+  std::vector<int> indices;
+
+  /// The force deltas received: All dfx, then all dfy, then all dfz
+  std::vector<double> deltas;
 };
 }    // namespace LAMMPS_NS
 
@@ -1,9 +1,14 @@
 #include "fix_arbfn_ffield.h"
+#include "arbfn_columns.h"
+#include "grid_codec.h"
 #include "interchange.h"
 #include "interpolation.h"
 #include "utils.h"
+#include <algorithm>
+#include <cmath>
 #include <domain.h>
 #include <mpi.h>
+#include <neighbor.h>
 #include <string>
 
 LAMMPS_NS::FixArbFnFField::FixArbFnFField(class LAMMPS *_lmp, int _c, char **_v) : Fix(_lmp, _c, _v)
@@ -42,6 +47,83 @@ LAMMPS_NS::FixArbFnFField::FixArbFnFField(class LAMMPS *_lmp, int _c, char **_v)
       ++i;
     } else if (strcmp(arg, "dipole") == 0) {
       is_dipole = !is_dipole;
+    } else if (strcmp(arg, "compress") == 0) {
+      if (i + 1 >= _c) {
+        error->universe_one(FLERR,
+                            "Malformed `fix arbfn/ffield': Missing argument for `compress'.");
+      }
+      if (strcmp(_v[i + 1], "float32") == 0) {
+        compression.encoding = ARBFN_GRID_FLOAT32;
+        ++i;
+      } else if (strcmp(_v[i + 1], "fixed") == 0) {
+        if (i + 2 >= _c) {
+          error->universe_one(FLERR, "Malformed `fix arbfn/ffield': Missing tolerance for "
+                                     "`compress fixed'.");
+        }
+        compression.encoding = ARBFN_GRID_FIXED;
+        compression.tolerance = utils::numeric(FLERR, _v[i + 2], false, _lmp);
+        if (compression.tolerance <= 0.0) {
+          error->universe_one(FLERR, "Malformed `fix arbfn/ffield': `compress fixed' tolerance "
+                                     "must be positive.");
+        }
+        i += 2;
+      } else {
+        error->universe_one(FLERR, "Malformed `fix arbfn/ffield': Unknown encoding `" +
+                                std::string(_v[i + 1]) + "' for `compress'.");
+      }
+    } else if (strcmp(arg, "deflate") == 0) {
+      if (!ARBFN_HAS_ZLIB) {
+        error->universe_one(FLERR, "`fix arbfn/ffield': `deflate' requires ARBFN to be built "
+                                   "with ARBFN_ZLIB.");
+      }
+      compression.deflate = true;
+    } else if (strcmp(arg, "grid") == 0) {
+      if (i + 1 >= _c) {
+        error->universe_one(FLERR, "Malformed `fix arbfn/ffield': Missing argument for `grid'.");
+      }
+      if (strcmp(_v[i + 1], "full") == 0) {
+        full_grid = true;
+      } else if (strcmp(_v[i + 1], "local") == 0) {
+        full_grid = false;
+      } else {
+        error->universe_one(FLERR, "Malformed `fix arbfn/ffield': Unknown `grid' `" +
+                                std::string(_v[i + 1]) + "'.");
+      }
+      ++i;
+    } else if (strcmp(arg, "shared") == 0) {
+      if (i + 1 >= _c) {
+        error->universe_one(FLERR,
+                            "Malformed `fix arbfn/ffield': Missing argument for `shared'.");
+      }
+      if (strcmp(_v[i + 1], "node") == 0) {
+        shared = true;
+      } else if (strcmp(_v[i + 1], "none") == 0) {
+        shared = false;
+      } else {
+        error->universe_one(FLERR, "Malformed `fix arbfn/ffield': Unknown `shared' mode `" +
+                                std::string(_v[i + 1]) + "'.");
+      }
+      ++i;
+    } else if (strcmp(arg, "interp") == 0) {
+      if (i + 1 >= _c) {
+        error->universe_one(FLERR,
+                            "Malformed `fix arbfn/ffield': Missing argument for `interp'.");
+      }
+      if (!interpolation_from_name(_v[i + 1], interp)) {
+        error->universe_one(FLERR, "Malformed `fix arbfn/ffield': Unknown `interp' `" +
+                                std::string(_v[i + 1]) + "'.");
+      }
+      ++i;
+    } else if (strcmp(arg, "waitmode") == 0) {
+      if (i + 1 >= _c) {
+        error->universe_one(FLERR,
+                            "Malformed `fix arbfn/ffield': Missing argument for `waitmode'.");
+      }
+      if (!wait_mode_from_name(_v[i + 1], wait)) {
+        error->universe_one(FLERR, "Malformed `fix arbfn/ffield': Unknown `waitmode' `" +
+                                std::string(_v[i + 1]) + "'.");
+      }
+      ++i;
     }
 
     else {
@@ -50,146 +132,253 @@ LAMMPS_NS::FixArbFnFField::FixArbFnFField(class LAMMPS *_lmp, int _c, char **_v)
     }
   }
 
-  // Dynalloc
-  nodes = new double ***[node_counts[0]];
-  for (uint x_bin = 0; x_bin < node_counts[0]; ++x_bin) {
-    nodes[x_bin] = new double **[node_counts[1]];
-    for (uint y_bin = 0; y_bin < node_counts[1]; ++y_bin) {
-      nodes[x_bin][y_bin] = new double *[node_counts[2]];
-      for (uint z_bin = 0; z_bin < node_counts[2]; ++z_bin) {
-        nodes[x_bin][y_bin][z_bin] = new double[3];
-        nodes[x_bin][y_bin][z_bin][0] = 0.0;
-        nodes[x_bin][y_bin][z_bin][1] = 0.0;
-        nodes[x_bin][y_bin][z_bin][2] = 0.0;
-      }
-    }
+  // B-spline coefficients depend on every node along each line, so a cut grid would change them
+  if (interp == ARBFN_INTERP_BSPLINE3) { full_grid = true; }
+
+  // Group the ranks which share memory, keeping their order from world. One grid serves them
+  // all, so it must be the whole grid.
+  if (shared) {
+    full_grid = true;
+    MPI_Comm_split_type(world, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &node_rank);
   }
 }
 
 LAMMPS_NS::FixArbFnFField::~FixArbFnFField()
 {
-  send_deregistration(controller_rank, comm);
+  if (node_rank == 0) { send_deregistration(controller_rank, comm); }
+  if (window != MPI_WIN_NULL) {
+    MPI_Win_unlock_all(window);
+    MPI_Win_free(&window);
+  }
+  if (node != MPI_COMM_NULL) { MPI_Comm_free(&node); }
   MPI_Comm_free(&comm);
+}
 
-  if (nodes == nullptr) { return; }
-
-  // Free bins here
-  for (uint x_bin = 0; x_bin < node_counts[0]; ++x_bin) {
-    for (uint y_bin = 0; y_bin < node_counts[1]; ++y_bin) {
-      for (uint z_bin = 0; z_bin < node_counts[2]; ++z_bin) { delete[] nodes[x_bin][y_bin][z_bin]; }
-      delete[] nodes[x_bin][y_bin];
+void LAMMPS_NS::FixArbFnFField::init()
+{
+  // With a shared grid, only the leader of each node registers
+  if (node_rank == 0) {
+    bool res = send_registration(controller_rank, comm, handshake, world);
+    if (!res) {
+      error->universe_one(
+          FLERR, "`fix arbfn/ffield' failed to register with controller: Ensure it is running.");
     }
-    delete[] nodes[x_bin];
   }
-  delete[] nodes;
+  if (shared) { share_handshake(node, handshake); }
+  columns = resolve_columns(lmp, "arbfn/ffield", handshake, is_dipole);
+  if (shared && node_rank == 0) { gather.merged = columns; }
+  members.clear();
+  members_built = -1;
+
+  // Populate bins from controller here
+  // This is the first one, so we don't send any atomic data
+  locate_grid();
+  fetch_grid(0, columns);
+  inherit_nodes();
 }
 
-void LAMMPS_NS::FixArbFnFField::init()
+void LAMMPS_NS::FixArbFnFField::post_force(int)
 {
-  // Allocate bins here
-  // double ****_all_force_deltas;
-  //        |||^3-tuple for force deltas
-  //        ||^z positions
-  //        |^y positions
-  //        ^x positions
+  group_indices(lmp, igroup, members, members_built);
+  update_grid(1);
+
+  // Interpolate for the whole group at once
+  deltas.resize(3 * members.size());
+  add_field(0, members.size());
+}
 
-  bool res = send_registration(controller_rank, comm);
-  if (!res) {
-    error->universe_one(
-        FLERR, "`fix arbfn/ffield' failed to register with controller: Ensure it is running.");
+void LAMMPS_NS::FixArbFnFField::refresh(const int &_threads)
+{
+  // Move only the requested fields from LAMMPS into the columns
+  const size_t n = pack_columns(lmp, columns, members, false, _threads);
+  refreshed = true;
+  if (!shared) {
+    fetch_grid(n, columns);
+    return;
   }
 
-  // Populate bins from controller here
-  // This is the first one, so we don't send any atomic data
-  const auto points =
-      ffield_interchange(lmp->domain->boxlo, bin_deltas, node_counts, controller_rank, comm, every);
-
-  for (const auto &p : points) {
-    if (p.x_index >= node_counts[0]) {
-      error->universe_one(FLERR, "`fix arbfn/ffield' controller sent invalid x bin.");
-    } else if (p.ybin >= node_counts[1]) {
-      error->universe_one(FLERR, "`fix arbfn/ffield' controller sent invalid y bin.");
-    } else if (p.zbin >= node_counts[2]) {
-      error->universe_one(FLERR, "`fix arbfn/ffield' controller sent invalid z bin.");
-    }
-    nodes[p.x_index][p.ybin][p.zbin][0] += p.dfx;
-    nodes[p.x_index][p.ybin][p.zbin][1] += p.dfy;
-    nodes[p.x_index][p.ybin][p.zbin][2] += p.dfz;
+  // The leader sends the atoms of the whole node, rank after rank
+  const size_t total = gather_columns(node, n, columns, gather);
+  fetch_grid(total, gather.merged);
+}
+
+void LAMMPS_NS::FixArbFnFField::fetch_grid(const size_t &_atoms,
+                                           const std::vector<AtomColumn> &_columns)
+{
+  // No rank on the node may still be reading the shared grid while the leader adds to it
+  if (shared) { MPI_Barrier(node); }
+
+  if (node_rank == 0 &&
+      !ffield_interchange(grid_start, bin_deltas, grid_counts, controller_rank, comm, every,
+                          _atoms, _columns, compression, nodes, wait)) {
+    error->universe_one(FLERR, "`fix arbfn/ffield' failed to receive grid from controller.");
   }
+  if (node_rank == 0 && interp == ARBFN_INTERP_BSPLINE3) {
+    bspline_coefficients(coefficients, nodes);
+  }
+  if (!shared) { return; }
+
+  // Nor may any read it before the leader is done. The whole node keeps refreshing together.
+  MPI_Win_sync(window);
+  MPI_Barrier(node);
+  MPI_Win_sync(window);
+
+  uint64_t next = every;
+  MPI_Bcast(&next, 1, MPI_UINT64_T, 0, node);
+  every = next;
 }
 
-void LAMMPS_NS::FixArbFnFField::post_force(int)
+void LAMMPS_NS::FixArbFnFField::attach_shared()
 {
-  // Special refresh case
-  if (every && ++counter >= every) {
-    counter = 0;
+  // The leader allocates the whole block, which every rank then finds. B-spline coefficients
+  // follow the nodes in it.
+  const size_t grids = interp == ARBFN_INTERP_BSPLINE3 ? 2 : 1;
+  const size_t doubles = NodeGrid::size_for(grid_counts);
+  const MPI_Aint bytes = node_rank == 0 ? grids * doubles * sizeof(double) : 0;
+  double *block = nullptr;
+  MPI_Win_allocate_shared(bytes, sizeof(double), MPI_INFO_NULL, node, &block, &window);
 
-    const double *const *const x = atom->x;
-    const double *const *const v = atom->v;
-    const double *const *const mu = atom->mu;
-    const int *const mask = atom->mask;
-
-    double *const *const f = atom->f;
-
-    // Move from LAMMPS atom format to AtomData struct
-    std::vector<AtomData> to_send;
-    size_t n = 0;
-    for (size_t i = 0; i < atom->nlocal; ++i) {
-      if (mask[i] & groupbit) {
-        AtomData to_add;
-        to_add.x = x[i][0];
-        to_add.y = x[i][1];
-        to_add.z = x[i][2];
-        to_add.vx = v[i][0];
-        to_add.vy = v[i][1];
-        to_add.vz = v[i][2];
-        to_add.fx = f[i][0];
-        to_add.fy = f[i][1];
-        to_add.fz = f[i][2];
-
-        to_add.is_dipole = is_dipole;
-        if (to_add.is_dipole) {
-          to_add.mux = mu[i][0];
-          to_add.muy = mu[i][1];
-          to_add.muz = mu[i][2];
-        }
+  MPI_Aint size;
+  int unit;
+  MPI_Win_shared_query(window, 0, &size, &unit, &block);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
 
-        to_send.push_back(to_add);
-        ++n;
-      }
+  nodes.attach(grid_counts, block);
+  if (node_rank == 0) { nodes.clear(); }
+  if (grids == 2) { coefficients.attach(grid_counts, block + doubles); }
+}
+
+bool LAMMPS_NS::FixArbFnFField::locate_grid()
+{
+  uint first[3] = {0, 0, 0}, counts[3] = {node_counts[0], node_counts[1], node_counts[2]};
+
+  // Triclinic subdomains are only known in lamda coordinates, so those hold the whole grid
+  if (!full_grid && !domain->triclinic) {
+    // Atoms may drift up to half the skin out of the subdomain between reneighborings. A cubic
+    // stencil reaches one node further.
+    double ghosts[3];
+    for (int i = 0; i < 3; ++i) {
+      ghosts[i] = std::max(1.0, std::ceil(0.5 * neighbor->skin / bin_deltas[i]));
+      if (interp == ARBFN_INTERP_CUBIC) { ghosts[i] += 1.0; }
     }
+    subdomain_nodes(first, counts, domain->sublo, domain->subhi, domain->boxlo, bin_deltas,
+                    node_counts, ghosts);
 
-    const auto points =
-        ffield_interchange(lmp->domain->boxlo, bin_deltas, node_counts, controller_rank, comm,
-                           every, to_send.size(), to_send.data());
-
-    for (const auto &p : points) {
-      if (p.x_index >= node_counts[0]) {
-        error->universe_one(FLERR, "`fix arbfn/ffield' controller sent invalid x bin.");
-      } else if (p.ybin >= node_counts[1]) {
-        error->universe_one(FLERR, "`fix arbfn/ffield' controller sent invalid y bin.");
-      } else if (p.zbin >= node_counts[2]) {
-        error->universe_one(FLERR, "`fix arbfn/ffield' controller sent invalid z bin.");
-      }
-      nodes[p.x_index][p.ybin][p.zbin][0] += p.dfx;
-      nodes[p.x_index][p.ybin][p.zbin][1] += p.dfy;
-      nodes[p.x_index][p.ybin][p.zbin][2] += p.dfz;
+    // Atoms may still stray further (EG with `neigh_modify check no`). Rather than extrapolate
+    // from the edge of these nodes, the grid widens to cover them. Only past the box's own edges
+    // is the field extrapolated.
+    double lo[3], hi[3];
+    std::copy(domain->sublo, domain->sublo + 3, lo);
+    std::copy(domain->subhi, domain->subhi + 3, hi);
+    group_extent(lo, hi);
+
+    const double margin = interp == ARBFN_INTERP_CUBIC ? 1.0 : 0.0;
+    bool stray = false;
+    for (int i = 0; i < 3; ++i) {
+      const double covered_lo = domain->boxlo[i] + (first[i] + margin) * bin_deltas[i];
+      const double covered_hi =
+          domain->boxlo[i] + (first[i] + counts[i] - 1.0 - margin) * bin_deltas[i];
+      stray = stray || (first[i] > 0 && lo[i] < covered_lo) ||
+          (first[i] + counts[i] < node_counts[i] && hi[i] > covered_hi);
+    }
+    if (stray) {
+      subdomain_nodes(first, counts, lo, hi, domain->boxlo, bin_deltas, node_counts, ghosts);
     }
   }
 
+  // The box itself may move or change size
+  for (int i = 0; i < 3; ++i) { grid_start[i] = domain->boxlo[i] + first[i] * bin_deltas[i]; }
+
+  if (std::equal(first, first + 3, first_node) && std::equal(counts, counts + 3, grid_counts)) {
+    return false;
+  }
+  // Refreshes were added into the old nodes, and only here. Those still needed are kept (shared
+  // grids are always whole, so never move once attached).
+  if (refreshed && !shared) {
+    previous.swap(nodes);
+    std::copy(first_node, first_node + 3, previous_first);
+  }
+  std::copy(first, first + 3, first_node);
+  std::copy(counts, counts + 3, grid_counts);
+  if (shared) {
+    attach_shared();
+  } else {
+    nodes.allocate(grid_counts);
+  }
+  return true;
+}
+
+void LAMMPS_NS::FixArbFnFField::inherit_nodes()
+{
+  if (previous.node_counts()[0] == 0) { return; }
+  const size_t kept = copy_overlap(nodes, first_node, previous, previous_first);
+  NodeGrid().swap(previous);
+
+  // The controller only ever added the refreshes into the nodes it sent this rank, so new ones
+  // hold the field as first fetched
+  const size_t total = (size_t) grid_counts[0] * grid_counts[1] * grid_counts[2];
+  if (kept < total && !warned_fresh) {
+    warned_fresh = true;
+    error->warning(FLERR,
+                   "`fix arbfn/ffield' moved its nodes after a refresh: " +
+                       std::to_string(total - kept) +
+                       " new nodes lack earlier refreshes. Use `grid full' to avoid this.");
+  }
+}
+
+void LAMMPS_NS::FixArbFnFField::group_extent(double _lo[3], double _hi[3])
+{
   const double *const *const x = atom->x;
-  const int *const mask = atom->mask;
-  double *const *const f = atom->f;
-  double force_deltas[3];
-
-  for (size_t i = 0; i < atom->nlocal; ++i) {
-    if (mask[i] & groupbit) {
-      interpolate(force_deltas, x[i], lmp->domain->boxlo, nodes, bin_deltas, node_counts);
-      f[i][0] += force_deltas[0];
-      f[i][1] += force_deltas[1];
-      f[i][2] += force_deltas[2];
+  for (const int i : members) {
+    for (int k = 0; k < 3; ++k) {
+      _lo[k] = std::min(_lo[k], x[i][k]);
+      _hi[k] = std::max(_hi[k], x[i][k]);
+    }
+  }
+}
+
+bool LAMMPS_NS::FixArbFnFField::update_grid(const int &_threads)
+{
+  const bool moved = locate_grid();
+  const bool due = every && ++counter >= every;
+
+  // New nodes are fetched just as the first ones were, and keep what was refreshed of the old
+  if (moved) {
+    fetch_grid(0, columns);
+    inherit_nodes();
+  }
+
+  // Special refresh case
+  if (due) {
+    counter = 0;
+    refresh(_threads);
+  }
+  return due || moved;
+}
+
+void LAMMPS_NS::FixArbFnFField::add_field(const size_t &_begin, const size_t &_end)
+{
+  if (_begin >= _end) { return; }
+  if (interp == ARBFN_INTERP_LINEAR) {
+    interpolate_batch(_end - _begin, atom->x[0], members.data() + _begin,
+                      deltas.data() + 3 * _begin, grid_start, nodes, bin_deltas);
+  } else {
+    const NodeGrid &grid = interp == ARBFN_INTERP_BSPLINE3 ? coefficients : nodes;
+    double *const *const x = atom->x;
+    for (size_t j = _begin; j < _end; ++j) {
+      interpolate_cubic(deltas.data() + 3 * j, x[members[j]], grid_start, grid, bin_deltas,
+                        interp);
     }
   }
+
+  double *const *const f = atom->f;
+  for (size_t j = _begin; j < _end; ++j) {
+    const int i = members[j];
+    f[i][0] += deltas[3 * j];
+    f[i][1] += deltas[3 * j + 1];
+    f[i][2] += deltas[3 * j + 2];
+  }
 }
 
 int LAMMPS_NS::FixArbFnFField::setmask()
@@ -26,11 +26,14 @@ FixStyle(arbfn/ffield,FixArbFnFField);
 #ifndef FIX_ARBFN_FFIELD_HPP
 #define FIX_ARBFN_FFIELD_HPP
 
+#include "arbfn_columns.h"
 #include "atom.h"
 #include "comm.h"
 #include "error.h"
 #include "fix.h"
+#include "grid_codec.h"
 #include "interchange.h"
+#include "interpolation.h"
 
 namespace LAMMPS_NS {
 /**
@@ -38,8 +41,8 @@ namespace LAMMPS_NS {
  * @brief Sets up a static force field of a finite number of
  * nodes upon initialization via MPI. Uses a modified ARBFN
  * protocol to communicate with the controller. Particles have
- * fixes applied to them by linear interpolation based on their
- * POSITIONS between nodes. This is independent of their
+ * fixes applied to them by linear (or cubic) interpolation based
+ * on their POSITIONS between nodes. This is independent of their
  * velocities or existing total force.
  */
 class FixArbFnFField : public Fix {
@@ -60,6 +63,37 @@ class FixArbFnFField : public Fix {
   int setmask() override;
 
  protected:
+  /// Send the group's atoms to the controller and add the grid it sends back into the nodes,
+  /// packing the atoms on the given number of threads
+  virtual void refresh(const int &_threads);
+
+  /// Ask the controller for this rank's nodes, sending the first `_atoms` atoms of `_columns`,
+  /// and add them into `nodes`. With a shared grid, the leader does so for the whole node.
+  void fetch_grid(const size_t &_atoms, const std::vector<AtomColumn> &_columns);
+
+  /// Make `nodes` a view of one grid in memory shared by the whole node (shared only)
+  void attach_shared();
+
+  /// Find the nodes this rank needs: Those covering its subdomain plus a ghost cell on each
+  /// side (or the whole grid), widened to any group atoms which strayed past those. Reallocates
+  /// `nodes` and returns true if they changed.
+  bool locate_grid();
+
+  /// Lower `_lo` and raise `_hi` to cover every atom of the group listed in `members`
+  virtual void group_extent(double _lo[3], double _hi[3]);
+
+  /// Fetch the grid again if this rank now needs other nodes (EG after load balancing), keeping
+  /// the refreshes added into any nodes it still holds, then refresh it if due. Returns true if
+  /// the nodes changed.
+  bool update_grid(const int &_threads);
+
+  /// Copy the nodes `previous` shares with `nodes` into the latter, then let `previous` go
+  void inherit_nodes();
+
+  /// Interpolate for `members[_begin]` up to (not including) `members[_end]`, saving the
+  /// deltas in `deltas` and adding them to the atoms' forces. `deltas` must already fit.
+  void add_field(const size_t &_begin, const size_t &_end);
+
   /// The MPI rank of the controller
   uint controller_rank;
 
@@ -75,8 +109,55 @@ class FixArbFnFField : public Fix {
   /// The widths of bins in x/y/z
   double bin_deltas[3];
 
-  /// Dynamically allocated nodes to interpolate between
-  double ****nodes = nullptr;
+  /// The global index of this rank's first node in x/y/z
+  uint first_node[3] = {0, 0, 0};
+
+  /// The number of nodes this rank holds in x/y/z
+  uint grid_counts[3] = {0, 0, 0};
+
+  /// The position of this rank's first node
+  double grid_start[3] = {0.0, 0.0, 0.0};
+
+  /// If true, every rank holds the whole grid instead of just its subdomain's nodes
+  bool full_grid = false;
+
+  /// If true, the whole grid is held once per node in shared memory, and only the node's leader
+  /// talks to the controller
+  bool shared = false;
+
+  /// The ranks sharing this node (shared only)
+  MPI_Comm node = MPI_COMM_NULL;
+
+  /// This rank's position in `node`. Rank 0 is the leader.
+  int node_rank = 0;
+
+  /// The shared memory window holding `nodes` (shared only)
+  MPI_Win window = MPI_WIN_NULL;
+
+  /// The buffers to gather the node's atoms onto its leader with (shared only)
+  NodeGather gather;
+
+  /// How to interpolate between nodes
+  Interpolation interp = ARBFN_INTERP_LINEAR;
+
+  /// The nodes to interpolate between
+  NodeGrid nodes;
+
+  /// The B-spline coefficients of `nodes` (bspline3 only). Shared like `nodes`.
+  NodeGrid coefficients;
+
+  /// The nodes this rank held before they last moved, until inherit_nodes copies them over. Only
+  /// kept once refreshes have been added into them.
+  NodeGrid previous;
+
+  /// The global index of the first node of `previous` in x/y/z
+  uint previous_first[3] = {0, 0, 0};
+
+  /// True once any refresh has been added into the nodes
+  bool refreshed = false;
+
+  /// True once this rank has warned that new nodes lack earlier refreshes
+  bool warned_fresh = false;
 
   /// Call on the controller for a grid refresh every (this many) frames.
   /// If 0, never update after instantiation.
@@ -87,6 +168,28 @@ class FixArbFnFField : public Fix {
 
   /// True iff we should send mu data
   bool is_dipole = false;
+
+  /// The settings negotiated with the controller
+  Handshake handshake;
+
+  /// How to wait for the controller
+  WaitMode wait = ARBFN_WAIT_SLEEP;
+
+  /// The per-atom fields the controller asked for
+  std::vector<AtomColumn> columns;
+
+  /// The local index of each atom in the group, as of the neighbor list build at
+  /// `members_built`, or of this call for dynamic groups (see group_indices)
+  std::vector<int> members;
+
+  /// The timestep `members` was listed at, or -1 to list it again
+  bigint members_built = -1;
+
+  /// The interpolated (dfx, dfy, dfz) of each atom in `members`
+  std::vector<double> deltas;
+
+  /// The grid compression to ask the controller for
+  GridCompression compression;
 };
 }    // namespace LAMMPS_NS
 
@@ -0,0 +1,102 @@
+#ifdef LMP_KOKKOS
+#include "fix_arbfn_ffield_kokkos.h"
+#include "arbfn_columns.h"
+#include "atom_kokkos.h"
+#include "atom_masks.h"
+#include "domain.h"
+#include "memory_kokkos.h"
+#include <algorithm>
+
+template <class DeviceType>
+LAMMPS_NS::FixArbFnFFieldKokkos<DeviceType>::FixArbFnFFieldKokkos(class LAMMPS *_lmp, int _c,
+                                                                  char **_v)
+    : FixArbFnFField(_lmp, _c, _v)
+{
+  kokkosable = 1;
+  atomKK = (AtomKokkos *) atom;
+  execution_space = ExecutionSpaceFromDevice<DeviceType>::space;
+
+  datamask_read = X_MASK | F_MASK | MASK_MASK;
+  datamask_modify = F_MASK;
+
+  if (interp != ARBFN_INTERP_LINEAR) {
+    error->universe_one(FLERR, "`fix arbfn/ffield/kk' only supports `interp linear'.");
+  }
+}
+
+template <class DeviceType> LAMMPS_NS::FixArbFnFFieldKokkos<DeviceType>::~FixArbFnFFieldKokkos()
+{
+  memoryKK->destroy_kokkos(k_nodes);
+}
+
+template <class DeviceType> void LAMMPS_NS::FixArbFnFFieldKokkos<DeviceType>::init()
+{
+  FixArbFnFField::init();
+  upload_nodes();
+}
+
+template <class DeviceType> void LAMMPS_NS::FixArbFnFFieldKokkos<DeviceType>::post_force(int)
+{
+  atomKK->sync(execution_space, X_MASK | F_MASK | MASK_MASK);
+  if (update_grid(1)) { upload_nodes(); }
+
+  Interpolator interpolator;
+  interpolator.describe(groupbit, grid_start, bin_deltas, nodes);
+  interpolator.x = atomKK->k_x.template view<DeviceType>();
+  interpolator.f = atomKK->k_f.template view<DeviceType>();
+  interpolator.mask = atomKK->k_mask.template view<DeviceType>();
+  interpolator.nodes = k_nodes.template view<DeviceType>();
+
+  Kokkos::parallel_for(Kokkos::RangePolicy<DeviceType>(0, atom->nlocal), interpolator);
+
+  atomKK->modified(execution_space, F_MASK);
+}
+
+template <class DeviceType>
+void LAMMPS_NS::FixArbFnFFieldKokkos<DeviceType>::refresh(const int &_threads)
+{
+  // The controller needs the atoms on the host
+  atomKK->sync(Host, X_MASK | V_MASK | F_MASK | MASK_MASK | TYPE_MASK | TAG_MASK | Q_MASK |
+                         MU_MASK);
+  group_indices(lmp, igroup, members, members_built);
+  FixArbFnFField::refresh(_threads);
+}
+
+template <class DeviceType>
+void LAMMPS_NS::FixArbFnFFieldKokkos<DeviceType>::group_extent(double _lo[3], double _hi[3])
+{
+  atomKK->sync(execution_space, X_MASK | MASK_MASK);
+
+  Extent extent;
+  extent.x = atomKK->k_x.template view<DeviceType>();
+  extent.mask = atomKK->k_mask.template view<DeviceType>();
+  extent.groupbit = groupbit;
+
+  typename Extent::value_type bounds;
+  Kokkos::parallel_reduce(Kokkos::RangePolicy<DeviceType>(0, atom->nlocal), extent, bounds);
+  for (int k = 0; k < 3; ++k) {
+    _lo[k] = std::min(_lo[k], bounds.lo[k]);
+    _hi[k] = std::max(_hi[k], bounds.hi[k]);
+  }
+}
+
+template <class DeviceType> void LAMMPS_NS::FixArbFnFFieldKokkos<DeviceType>::upload_nodes()
+{
+  if (k_nodes.extent(0) != nodes.size()) {
+    memoryKK->destroy_kokkos(k_nodes);
+    memoryKK->create_kokkos(k_nodes, nodes.size(), "arbfn/ffield:nodes");
+  }
+
+  const double *const from = nodes.data();
+  for (size_t i = 0; i < nodes.size(); ++i) { k_nodes.template view<LMPHostType>()(i) = from[i]; }
+  k_nodes.template modify<LMPHostType>();
+  k_nodes.template sync<DeviceType>();
+}
+
+namespace LAMMPS_NS {
+template class FixArbFnFFieldKokkos<LMPDeviceType>;
+#ifdef LMP_KOKKOS_GPU
+template class FixArbFnFFieldKokkos<LMPHostType>;
+#endif
+}    // namespace LAMMPS_NS
+#endif    // LMP_KOKKOS
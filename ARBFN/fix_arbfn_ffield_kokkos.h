@@ -0,0 +1,93 @@
+/* -*- c++ -*- ----------------------------------------------------------
+    LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+    https://www.lammps.org/, Sandia National Laboratories
+    LAMMPS development team: developers@lammps.org
+
+    Copyright (2003) Sandia Corporation.  Under the terms of Contract
+    DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+    certain rights in this software.  This software is distributed under
+    the GNU General Public License.
+
+    See the README file in the top-level LAMMPS directory.
+-------------------------------------------------------------------------
+    Defines the `fix arbfn/ffield/kk` class for extending LAMMPS, in the
+    shape of the styles of the KOKKOS package. Only built when LAMMPS is
+    built with KOKKOS. Based on work funded by NSF grant 2126451 at
+    Colorado Mesa University.
+
+    J Dehmel, J Schiffbauer, 2024/2025
+------------------------------------------------------------------------- */
+
+#ifdef FIX_CLASS
+#ifdef LMP_KOKKOS
+// clang-format off
+FixStyle(arbfn/ffield/kk,FixArbFnFFieldKokkos<LMPDeviceType>);
+FixStyle(arbfn/ffield/kk/device,FixArbFnFFieldKokkos<LMPDeviceType>);
+FixStyle(arbfn/ffield/kk/host,FixArbFnFFieldKokkos<LMPHostType>);
+// clang-format on
+#endif
+#else
+
+#ifndef FIX_ARBFN_FFIELD_KOKKOS_HPP
+#define FIX_ARBFN_FFIELD_KOKKOS_HPP
+
+#ifdef LMP_KOKKOS
+#include "fix_arbfn_ffield.h"
+#include "interpolation_kokkos.h"
+#include "kokkos_type.h"
+
+namespace LAMMPS_NS {
+/**
+ * @class FixArbFnFFieldKokkos
+ * @brief `fix arbfn/ffield`, but keeping a copy of the grid in
+ * a Kokkos view and interpolating in a `parallel_for` over the
+ * local atoms, straight on the KOKKOS atom views. Atoms are only
+ * synced to the host on refresh steps, to be sent to the
+ * controller; the grid it sends back is copied to the device.
+ * Only `interp linear` is supported: `interp cubic` and
+ * `interp bspline3` are rejected with an error.
+ */
+template <class DeviceType> class FixArbFnFFieldKokkos : public FixArbFnFField {
+ public:
+  typedef DeviceType device_type;
+  typedef ArrayTypes<DeviceType> AT;
+
+  /// The interpolation kernel, on this fix's device
+  typedef FFieldInterpolator<typename AT::t_x_array_randomread, typename AT::t_f_array,
+                             typename AT::t_int_1d_randomread, typename AT::t_double_1d_randomread>
+      Interpolator;
+
+  /// Finds the extent of the group, on this fix's device
+  typedef GroupExtent<typename AT::t_x_array_randomread, typename AT::t_int_1d_randomread>
+      Extent;
+
+  /// Initialize the fix
+  FixArbFnFFieldKokkos(class LAMMPS *, int, char **);
+
+  /// Destroy the fix and its device grid
+  ~FixArbFnFFieldKokkos() override;
+
+  /// Finish initialization and copy the first grid to the device
+  void init() override;
+
+  /// Interpolate and add force deltas on the device
+  void post_force(int) override;
+
+ protected:
+  /// Sync the atoms to the host, then refresh as `fix arbfn/ffield` does
+  void refresh(const int &_threads) override;
+
+  /// Find the extent of the group on the device, since `members` is not kept
+  void group_extent(double _lo[3], double _hi[3]) override;
+
+  /// Copy `nodes` into `k_nodes` and on to the device
+  void upload_nodes();
+
+  /// The device (and host) copy of `nodes`, ghosts included
+  DAT::tdual_double_1d k_nodes;
+};
+}    // namespace LAMMPS_NS
+
+#endif    // LMP_KOKKOS
+#endif    // FIX_ARBFN_FFIELD_KOKKOS_HPP
+#endif    // FIX_CLASS
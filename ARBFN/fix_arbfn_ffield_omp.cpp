@@ -0,0 +1,40 @@
+#include "fix_arbfn_ffield_omp.h"
+#include "arbfn_columns.h"
+#include "interpolation.h"
+#include <algorithm>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+LAMMPS_NS::FixArbFnFFieldOMP::FixArbFnFFieldOMP(class LAMMPS *_lmp, int _c, char **_v)
+    : FixArbFnFField(_lmp, _c, _v)
+{
+}
+
+void LAMMPS_NS::FixArbFnFFieldOMP::post_force(int)
+{
+  group_indices(lmp, igroup, members, members_built);
+  const int threads = std::max(lmp->comm->nthreads, 1);
+  update_grid(threads);
+
+  // Each thread takes a contiguous run of whole SIMD batches
+  const size_t n = members.size();
+  const size_t batches = (n + ARBFN_SIMD_LANES - 1) / ARBFN_SIMD_LANES;
+  deltas.resize(3 * n);
+
+#if defined(_OPENMP)
+#pragma omp parallel num_threads(threads)
+#endif
+  {
+#if defined(_OPENMP)
+    const size_t thread = omp_get_thread_num(), count = omp_get_num_threads();
+#else
+    const size_t thread = 0, count = 1;
+#endif
+    const size_t per_thread = (batches + count - 1) / count;
+    const size_t begin = std::min(n, thread * per_thread * ARBFN_SIMD_LANES);
+    const size_t end = std::min(n, (thread + 1) * per_thread * ARBFN_SIMD_LANES);
+    add_field(begin, end);
+  }
+}
@@ -0,0 +1,51 @@
+/* -*- c++ -*- ----------------------------------------------------------
+    LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+    https://www.lammps.org/, Sandia National Laboratories
+    LAMMPS development team: developers@lammps.org
+
+    Copyright (2003) Sandia Corporation.  Under the terms of Contract
+    DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+    certain rights in this software.  This software is distributed under
+    the GNU General Public License.
+
+    See the README file in the top-level LAMMPS directory.
+-------------------------------------------------------------------------
+    Defines the `fix arbfn/ffield/omp` class for extending LAMMPS, in the
+    shape of the styles of the OPENMP package. Based on work funded by
+    NSF grant 2126451 at Colorado Mesa University.
+
+    J Dehmel, J Schiffbauer, 2024/2025
+------------------------------------------------------------------------- */
+
+#ifdef FIX_CLASS
+// clang-format off
+FixStyle(arbfn/ffield/omp,FixArbFnFFieldOMP);
+// clang-format on
+#else
+
+#ifndef FIX_ARBFN_FFIELD_OMP_HPP
+#define FIX_ARBFN_FFIELD_OMP_HPP
+
+#include "fix_arbfn_ffield.h"
+
+namespace LAMMPS_NS {
+/**
+ * @class FixArbFnFFieldOMP
+ * @brief `fix arbfn/ffield`, but interpolating (and packing the
+ * atoms sent on refresh steps) on every OpenMP thread of the
+ * rank, as set by `package omp`. Each thread takes whole SIMD
+ * batches of atoms, so the forces match the serial fix bit for
+ * bit. Without OpenMP, this is the serial fix.
+ */
+class FixArbFnFFieldOMP : public FixArbFnFField {
+ public:
+  /// Initialize the fix
+  FixArbFnFFieldOMP(class LAMMPS *, int, char **);
+
+  /// Interpolate and add force deltas on every thread
+  void post_force(int) override;
+};
+}    // namespace LAMMPS_NS
+
+#endif    // FIX_ARBFN_FFIELD_OMP_HPP
+#endif    // FIX_CLASS
@@ -0,0 +1,386 @@
+/**
+ * @file ARBFN/grid_codec.h
+ * @brief Encodes and decodes the compressed form of an ffield
+ * grid response. Both the worker (`ffield_interchange`) and
+ * `controller.hpp` use these, so they live in a header.
+ * Deflate is only available when compiled with `ARBFN_ZLIB`
+ * defined (and linked with `-lz`).
+ * @author J Dehmel, J Schiffbauer, 2025, MIT License
+ */
+
+#ifndef ARBFN_GRID_CODEC_H
+#define ARBFN_GRID_CODEC_H
+
+#include "interchange.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#ifdef ARBFN_ZLIB
+#include <zlib.h>
+
+/// True iff grids may be deflated
+const static bool ARBFN_HAS_ZLIB = true;
+#else
+/// True iff grids may be deflated
+const static bool ARBFN_HAS_ZLIB = false;
+#endif
+
+/**
+ * @enum GridEncoding
+ * @brief How each force delta of a compressed grid is stored
+ */
+enum GridEncoding {
+  /// Raw doubles (lossless)
+  ARBFN_GRID_FLOAT64 = 0,
+
+  /// Floats, with about 7 significant digits
+  ARBFN_GRID_FLOAT32 = 1,
+
+  /// Per-axis fixed point in the narrowest integers (16 or 32-bit) which keep each axis within
+  /// a given absolute error. Axes which fit neither are sent as doubles.
+  ARBFN_GRID_FIXED = 2
+};
+
+/**
+ * @struct GridCompression
+ * @brief The compression a worker asks for in its gridRequest.
+ * The default asks for none, in which case the controller
+ * answers in JSON.
+ */
+struct GridCompression {
+  /// The encoding of each delta
+  GridEncoding encoding = ARBFN_GRID_FLOAT64;
+
+  /// The max absolute error per delta for ARBFN_GRID_FIXED
+  double tolerance = 0.0;
+
+  /// Whether the encoded deltas should also be deflated
+  bool deflate = false;
+
+  /// Whether JSON grids may be sent densely (without indices)
+  bool dense = true;
+};
+
+/**
+ * @struct GridHeader
+ * @brief The start of an ARBFN_BINARY_GRID packet. It is
+ * followed by the encoded (dfx, dfy, dfz) triples of `count`
+ * consecutive nodes in x-major order (z changes fastest),
+ * starting at node `first`, deflated if `deflated` is 1. A grid
+ * may be split over several packets (chunks).
+ */
+struct GridHeader {
+  /// Always ARBFN_BINARY_MAGIC
+  uint32_t magic;
+
+  /// Always ARBFN_BINARY_GRID
+  uint32_t type;
+
+  /// The number of nodes in this packet
+  uint64_t count;
+
+  /// The GridEncoding actually used
+  uint32_t encoding;
+
+  /// 1 iff the encoded deltas are deflated
+  uint32_t deflated;
+
+  /// The new `every` of the fix, or -1 to leave it as-is
+  int64_t every;
+
+  /// The x-major index of the first node in this packet
+  uint64_t first;
+
+  /// The number of nodes in the whole grid
+  uint64_t total;
+
+  /// For ARBFN_GRID_FIXED, the value of one step on each axis, or
+  /// 0 for an axis sent as doubles
+  double scale[3];
+
+  /// The size in bytes of each encoded delta on each axis: 2 or 4
+  /// (fixed point) or 8 (a double)
+  uint16_t width[3];
+
+  /// Always 0
+  uint16_t reserved;
+};
+
+/**
+ * @brief Gives the JSON name of a grid encoding
+ * @param _encoding The encoding
+ * @return Its name, as sent in a gridRequest
+ */
+inline std::string grid_encoding_name(const GridEncoding &_encoding)
+{
+  switch (_encoding) {
+    case ARBFN_GRID_FLOAT32:
+      return "float32";
+    case ARBFN_GRID_FIXED:
+      return "fixed";
+    default:
+      return "float64";
+  }
+}
+
+/**
+ * @brief Gives the size of one encoded delta
+ * @param _encoding The encoding
+ * @return The size in bytes
+ */
+inline size_t grid_value_size(const uint32_t &_encoding)
+{
+  return _encoding == ARBFN_GRID_FLOAT64 ? sizeof(double) : 4;
+}
+
+/**
+ * @brief Picks the step and integer width of one axis for
+ * ARBFN_GRID_FIXED: The narrowest integer whose range, at a step
+ * of twice the tolerance, covers the largest delta. The step is
+ * then shrunk to just cover it, so the error is usually well
+ * under the tolerance.
+ * @param _max The largest absolute delta on the axis
+ * @param _tolerance The max absolute error per delta
+ * @param _scale Where to save the step, or 0 if the axis must be
+ * sent as doubles
+ * @param _width Where to save the size of each value in bytes
+ */
+inline void fixed_axis(const double &_max, const double &_tolerance, double &_scale,
+                       uint16_t &_width)
+{
+  // Rounding to the nearest step is off by at most half a step
+  const double step = 2.0 * _tolerance;
+  const double int16_max = std::numeric_limits<int16_t>::max();
+  const double int32_max = std::numeric_limits<int32_t>::max();
+  if (!(step > 0.0) || !(_max < int32_max * step)) {
+    _scale = 0.0;
+    _width = sizeof(double);
+  } else if (_max < int16_max * step) {
+    _scale = _max > 0.0 ? _max / int16_max : step;
+    _width = sizeof(int16_t);
+  } else {
+    _scale = _max / int32_max;
+    _width = sizeof(int32_t);
+  }
+}
+
+/**
+ * @brief Encodes some consecutive nodes of a grid into an
+ * ARBFN_BINARY_GRID packet. With ARBFN_GRID_FIXED, each axis
+ * gets its own step and integer width (see fixed_axis), and is
+ * sent as doubles if it is too large for fixed point within the
+ * given tolerance. Deflate is skipped if unavailable.
+ * @param _deltas The (dfx, dfy, dfz) triples of the nodes in
+ * x-major order
+ * @param _compression The compression the worker asked for
+ * @param _every The new `every` of the fix, or -1 for no change
+ * @param _first The x-major index of the first node given
+ * @param _total The number of nodes in the whole grid
+ * @param _into Where to save the packet
+ */
+inline void encode_grid(const std::vector<double> &_deltas, const GridCompression &_compression,
+                        const int64_t &_every, const uint64_t &_first, const uint64_t &_total,
+                        std::vector<char> &_into)
+{
+  GridHeader header;
+  header.magic = ARBFN_BINARY_MAGIC;
+  header.type = ARBFN_BINARY_GRID;
+  header.count = _deltas.size() / 3;
+  header.encoding = _compression.encoding;
+  header.deflated = 0;
+  header.every = _every;
+  header.first = _first;
+  header.total = _total;
+  header.scale[0] = header.scale[1] = header.scale[2] = 0.0;
+  header.reserved = 0;
+  for (int k = 0; k < 3; ++k) { header.width[k] = grid_value_size(header.encoding); }
+
+  size_t node_size = 3 * grid_value_size(header.encoding);
+  if (header.encoding == ARBFN_GRID_FIXED) {
+    double max[3] = {0.0, 0.0, 0.0};
+    for (size_t i = 0; i < _deltas.size(); ++i) {
+      // NaNs and infinities can only be sent as doubles
+      const double size = std::isfinite(_deltas[i]) ? fabs(_deltas[i]) : HUGE_VAL;
+      max[i % 3] = std::max(max[i % 3], size);
+    }
+    node_size = 0;
+    for (int k = 0; k < 3; ++k) {
+      fixed_axis(max[k], _compression.tolerance, header.scale[k], header.width[k]);
+      node_size += header.width[k];
+    }
+  }
+
+  std::vector<char> encoded(header.count * node_size);
+  char *out = encoded.data();
+  for (size_t i = 0; i < _deltas.size(); ++i) {
+    const int k = i % 3;
+    if (header.encoding == ARBFN_GRID_FLOAT32) {
+      const float value = (float) _deltas[i];
+      memcpy(out, &value, sizeof(value));
+      out += sizeof(value);
+    } else if (header.encoding == ARBFN_GRID_FIXED && header.width[k] == sizeof(int16_t)) {
+      const int16_t value = (int16_t) lround(_deltas[i] / header.scale[k]);
+      memcpy(out, &value, sizeof(value));
+      out += sizeof(value);
+    } else if (header.encoding == ARBFN_GRID_FIXED && header.width[k] == sizeof(int32_t)) {
+      const int32_t value = (int32_t) lround(_deltas[i] / header.scale[k]);
+      memcpy(out, &value, sizeof(value));
+      out += sizeof(value);
+    } else {
+      memcpy(out, &_deltas[i], sizeof(double));
+      out += sizeof(double);
+    }
+  }
+
+#ifdef ARBFN_ZLIB
+  if (_compression.deflate) {
+    uLongf size = compressBound(encoded.size());
+    std::vector<char> deflated(size);
+    if (compress2((Bytef *) deflated.data(), &size, (const Bytef *) encoded.data(),
+                  encoded.size(), Z_DEFAULT_COMPRESSION) == Z_OK) {
+      deflated.resize(size);
+      encoded.swap(deflated);
+      header.deflated = 1;
+    }
+  }
+#endif
+
+  _into.resize(sizeof(header) + encoded.size());
+  memcpy(_into.data(), &header, sizeof(header));
+  memcpy(_into.data() + sizeof(header), encoded.data(), encoded.size());
+}
+
+/**
+ * @brief Decodes an ARBFN_BINARY_GRID packet, passing each
+ * node's deltas to the given callback as they are decoded. If
+ * the packet is deflated, it is inflated a piece at a time, so
+ * the whole decoded grid is never held in memory at once.
+ * @param _packet The packet
+ * @param _size The size of the packet in bytes
+ * @param _header Where to save the packet's header
+ * @param _on_node Called as `_on_node(index, dfx, dfy, dfz)`
+ * for every node in the packet, in x-major order. `index` is
+ * the node's x-major index in the whole grid.
+ * @param _error Where to save a description of any error
+ * @return True on success, false on failure
+ */
+template <class F>
+bool decode_grid(const char *_packet, const size_t &_size, GridHeader &_header, F _on_node,
+                 std::string &_error)
+{
+  if (_size < sizeof(_header)) {
+    _error = "truncated grid packet";
+    return false;
+  }
+  memcpy(&_header, _packet, sizeof(_header));
+  if (_header.magic != ARBFN_BINARY_MAGIC || _header.type != ARBFN_BINARY_GRID) {
+    _error = "bad grid packet header";
+    return false;
+  } else if (_header.encoding > ARBFN_GRID_FIXED) {
+    _error = "unknown grid encoding " + std::to_string(_header.encoding);
+    return false;
+  } else if (_header.first > _header.total || _header.count > _header.total - _header.first) {
+    _error = "grid packet runs past the end of the grid";
+    return false;
+  }
+
+  // Fixed point axes each have their own width. Any other encoding has one for all.
+  size_t widths[3], node_size = 0;
+  for (int k = 0; k < 3; ++k) {
+    widths[k] = grid_value_size(_header.encoding);
+    if (_header.encoding == ARBFN_GRID_FIXED) {
+      widths[k] = _header.width[k];
+      if (widths[k] != sizeof(int16_t) && widths[k] != sizeof(int32_t) &&
+          widths[k] != sizeof(double)) {
+        _error = "bad fixed point width " + std::to_string(widths[k]);
+        return false;
+      }
+    }
+    node_size += widths[k];
+  }
+  const char *payload = _packet + sizeof(_header);
+  size_t payload_size = _size - sizeof(_header);
+
+  // Decodes whole nodes from the front of `_from`, returning how many bytes were used
+  uint64_t node = 0;
+  auto decode = [&](const char *_from, const size_t &_bytes) {
+    size_t used = 0;
+    for (; used + node_size <= _bytes && node < _header.count; used += node_size, ++node) {
+      double deltas[3];
+      const char *at = _from + used;
+      for (int k = 0; k < 3; at += widths[k], ++k) {
+        if (_header.encoding == ARBFN_GRID_FLOAT32) {
+          float value;
+          memcpy(&value, at, sizeof(value));
+          deltas[k] = value;
+        } else if (_header.encoding == ARBFN_GRID_FIXED && widths[k] == sizeof(int16_t)) {
+          int16_t value;
+          memcpy(&value, at, sizeof(value));
+          deltas[k] = value * _header.scale[k];
+        } else if (_header.encoding == ARBFN_GRID_FIXED && widths[k] == sizeof(int32_t)) {
+          int32_t value;
+          memcpy(&value, at, sizeof(value));
+          deltas[k] = value * _header.scale[k];
+        } else {
+          memcpy(&deltas[k], at, sizeof(double));
+        }
+      }
+      _on_node(_header.first + node, deltas[0], deltas[1], deltas[2]);
+    }
+    return used;
+  };
+
+  if (_header.deflated) {
+#ifdef ARBFN_ZLIB
+    // Inflate into a small window, decoding whole nodes as they appear
+    char window[1 << 16];
+    size_t filled = 0;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) {
+      _error = "could not start inflating grid";
+      return false;
+    }
+    stream.next_in = (Bytef *) payload;
+    stream.avail_in = payload_size;
+
+    int status = Z_OK;
+    while (status != Z_STREAM_END) {
+      stream.next_out = (Bytef *) window + filled;
+      stream.avail_out = sizeof(window) - filled;
+      status = inflate(&stream, Z_NO_FLUSH);
+      if (status != Z_OK && status != Z_STREAM_END) {
+        inflateEnd(&stream);
+        _error = "could not inflate grid";
+        return false;
+      }
+      filled = sizeof(window) - stream.avail_out;
+
+      // Keep any partial node for the next round
+      const size_t used = decode(window, filled);
+      memmove(window, window + used, filled - used);
+      filled -= used;
+    }
+    inflateEnd(&stream);
+#else
+    _error = "grid is deflated, but ARBFN was built without ARBFN_ZLIB";
+    return false;
+#endif
+  } else {
+    decode(payload, payload_size);
+  }
+
+  if (node != _header.count) {
+    _error = "grid packet holds " + std::to_string(node) + " of " +
+        std::to_string(_header.count) + " nodes";
+    return false;
+  }
+  return true;
+}
+
+#endif    // ARBFN_GRID_CODEC_H
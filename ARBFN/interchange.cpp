@@ -4,195 +4,1545 @@
  */
 
 #include "interchange.h"
+#include "grid_codec.h"
+#include "interpolation.h"
 #include <boost/json/array.hpp>
+#include <boost/json/basic_parser_impl.hpp>
 #include <boost/json/src.hpp>
+#include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <mpi.h>
 #include <thread>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define ARBFN_HAS_TO_CHARS
+#endif
+#endif
+#endif
+
+/**
+ * @struct DeltaView
+ * @brief Where to write the force deltas of each atom: Atom i's dfx goes to dfx[i * stride] and
+ * so on. This covers both FixData arrays and structure-of-arrays buffers.
+ */
+struct DeltaView {
+  double *dfx;
+  double *dfy;
+  double *dfz;
+  size_t stride;
+};
+
+/**
+ * @brief Gives one component of one atom in a column
+ * @param _column The column to read from
+ * @param _i The atom
+ * @param _k The component
+ * @return The value
+ */
+inline double column_value(const AtomColumn &_column, const size_t &_i, const unsigned int &_k)
+{
+  if (_column.source != nullptr) {
+    return _column.source[_column.stride * _column.index[_i] + _k];
+  }
+  return _column.values[_i * _column.width + _k];
+}
+
+/**
+ * @brief Turn a JSON object into a std::string
+ * @param _what The JSON to stringify
+ * @return The string version
+ */
+std::string json_to_str(boost::json::value _what)
+{
+  std::stringstream s;
+  s << _what;
+  return s.str();
+}
+
+/**
+ * @brief Creates columns holding the given fields of some atoms
+ * @param _n The number of atoms
+ * @param _from The atoms to read from
+ * @param _fields The field names to copy, in wire order. Only x/v/f/mu are available.
+ * @param _into Where to save the columns
+ * @return True on success, false if a field is not available
+ */
+bool columns_from_atoms(const size_t &_n, const AtomData _from[],
+                        const std::vector<std::string> &_fields, std::vector<AtomColumn> &_into)
+{
+  _into.clear();
+  for (const auto &name : _fields) {
+    AtomColumn column = make_column(name);
+    column.values.resize(column.width * _n);
+    for (size_t i = 0; i < _n; ++i) {
+      double *const out = &column.values[3 * i];
+      if (column.field == ARBFN_FIELD_X) {
+        out[0] = _from[i].x, out[1] = _from[i].y, out[2] = _from[i].z;
+      } else if (column.field == ARBFN_FIELD_V) {
+        out[0] = _from[i].vx, out[1] = _from[i].vy, out[2] = _from[i].vz;
+      } else if (column.field == ARBFN_FIELD_F) {
+        out[0] = _from[i].fx, out[1] = _from[i].fy, out[2] = _from[i].fz;
+      } else if (column.field == ARBFN_FIELD_MU) {
+        out[0] = _from[i].mux, out[1] = _from[i].muy, out[2] = _from[i].muz;
+      } else {
+        std::cerr << "Field '" << name << "' is not available in AtomData\n";
+        return false;
+      }
+    }
+    _into.push_back(column);
+  }
+  return true;
+}
+
+/**
+ * @brief Appends the shortest text that parses back to exactly the given double. Non-finite
+ * numbers are written the same way `boost::json::serialize` writes them.
+ * @param _into The buffer to append to
+ * @param _what The number to write
+ */
+void append_double(std::string &_into, const double &_what)
+{
+  char text[32];
+  int size;
+
+  if (std::isnan(_what)) {
+    _into.append("null");
+    return;
+  } else if (std::isinf(_what)) {
+    _into.append(_what < 0.0 ? "-1e99999" : "1e99999");
+    return;
+  }
+
+#ifdef ARBFN_HAS_TO_CHARS
+  size = std::to_chars(text, text + sizeof(text) - 1, _what).ptr - text;
+  text[size] = '\0';
+#else
+  // Without `to_chars`, try the usual precision first and fall back on the exact one
+  size = snprintf(text, sizeof(text), "%.15g", _what);
+  if (strtod(text, nullptr) != _what) { size = snprintf(text, sizeof(text), "%.17g", _what); }
+#endif
+
+  _into.append(text, size);
+
+  // Keep doubles looking like doubles, as the DOM serializer does
+  if (text[strspn(text, "-0123456789")] == '\0') { _into.append(".0"); }
+}
+
+/**
+ * @brief Appends the given integer in decimal
+ * @param _into The buffer to append to
+ * @param _what The number to write
+ */
+void append_int(std::string &_into, const int64_t &_what)
+{
+  char text[24];
+  const int size = snprintf(text, sizeof(text), "%lld", (long long) _what);
+  _into.append(text, size);
+}
+
+/**
+ * @brief Appends the "atoms" list of a request packet, formatting straight from the columns
+ * without building any JSON objects. The JSON keys are escaped once per column, not per atom.
+ * @param _into The buffer to append to
+ * @param _n The number of atoms
+ * @param _columns The per-atom data
+ */
+void append_atoms(std::string &_into, const size_t &_n, const std::vector<AtomColumn> &_columns)
+{
+  // Prefix of every value, EG `,"vx":`. Reused between calls, so steady-state requests do not
+  // reallocate.
+  static std::vector<std::string> keys;
+  size_t count = 0;
+  for (const auto &column : _columns) {
+    for (unsigned int k = 0; k < column.width; ++k, ++count) {
+      if (keys.size() <= count) { keys.emplace_back(); }
+      keys[count].assign(",\"");
+      keys[count].append(column_key(column, k));
+      keys[count].append("\":");
+    }
+  }
+
+  _into.append("\"atoms\":[");
+  for (size_t i = 0; i < _n; ++i) {
+    if (i != 0) { _into.push_back(','); }
+    _into.push_back('{');
+
+    size_t key = 0;
+    for (const auto &column : _columns) {
+      for (unsigned int k = 0; k < column.width; ++k, ++key) {
+        // The first key of an atom has no leading comma
+        _into.append(keys[key], key == 0 ? 1 : 0, std::string::npos);
+
+        const double value = column_value(column, i, k);
+        if (column.is_integer) {
+          append_int(_into, (int64_t) value);
+        } else {
+          append_double(_into, value);
+        }
+      }
+    }
+
+    _into.push_back('}');
+  }
+  _into.push_back(']');
+}
+
+/**
+ * @class PacketHandler
+ * @brief Base SAX handler for `boost::json::basic_parser` which reads ARBFN packets: A top-level
+ * object holding scalars and a list of flat objects ("entries", EG atoms or nodes). Values are
+ * handed to the derived class's hooks as they are parsed, so no DOM is built. Anything else is
+ * skipped, so controllers may send extra data. Derived classes shadow the hooks they need.
+ * @tparam Derived The handler inheriting from this
+ */
+template <class Derived> class PacketHandler {
+ public:
+  constexpr static std::size_t max_object_size = std::size_t(-1);
+  constexpr static std::size_t max_array_size = std::size_t(-1);
+  constexpr static std::size_t max_key_size = std::size_t(-1);
+  constexpr static std::size_t max_string_size = std::size_t(-1);
+
+  /// The "type" of the packet
+  std::string type;
+
+  bool on_document_begin(boost::json::error_code &_ec)
+  {
+    depth = 0;
+    in_list = false;
+    type.clear();
+    key.clear();
+    return derived().on_packet_begin(_ec);
+  }
+
+  bool on_document_end(boost::json::error_code &) { return true; }
+
+  bool on_object_begin(boost::json::error_code &_ec)
+  {
+    ++depth;
+    const bool result = !(in_list && depth == 3) || derived().on_entry_begin(_ec);
+    key.clear();
+    return result;
+  }
+
+  bool on_object_end(std::size_t, boost::json::error_code &_ec)
+  {
+    const bool result = !(in_list && depth == 3) || derived().on_entry_end(_ec);
+    --depth;
+    key.clear();
+    return result;
+  }
+
+  bool on_array_begin(boost::json::error_code &)
+  {
+    ++depth;
+    if (depth == 2 && derived().is_list(key)) { in_list = true; }
+    key.clear();
+    return true;
+  }
+
+  bool on_array_end(std::size_t, boost::json::error_code &)
+  {
+    if (depth == 2) { in_list = false; }
+    --depth;
+    key.clear();
+    return true;
+  }
+
+  bool on_key_part(boost::json::string_view _s, std::size_t _n, boost::json::error_code &)
+  {
+    if (_n == _s.size()) { key.clear(); }
+    key.append(_s.data(), _s.size());
+    return true;
+  }
+
+  bool on_key(boost::json::string_view _s, std::size_t _n, boost::json::error_code &)
+  {
+    if (_n == _s.size()) { key.clear(); }
+    key.append(_s.data(), _s.size());
+    return true;
+  }
+
+  bool on_string_part(boost::json::string_view _s, std::size_t _n, boost::json::error_code &)
+  {
+    if (depth == 1 && key == "type") {
+      if (_n == _s.size()) { type.clear(); }
+      type.append(_s.data(), _s.size());
+    }
+    return true;
+  }
+
+  bool on_string(boost::json::string_view _s, std::size_t _n, boost::json::error_code &)
+  {
+    if (depth == 1 && key == "type") {
+      if (_n == _s.size()) { type.clear(); }
+      type.append(_s.data(), _s.size());
+    }
+    key.clear();
+    return true;
+  }
+
+  bool on_number_part(boost::json::string_view, boost::json::error_code &) { return true; }
+
+  bool on_int64(int64_t _i, boost::json::string_view, boost::json::error_code &_ec)
+  {
+    return on_number(_i, _ec);
+  }
+
+  bool on_uint64(uint64_t _u, boost::json::string_view, boost::json::error_code &_ec)
+  {
+    return on_number(_u, _ec);
+  }
+
+  bool on_double(double _d, boost::json::string_view, boost::json::error_code &_ec)
+  {
+    return on_number(_d, _ec);
+  }
+
+  bool on_bool(bool _b, boost::json::error_code &_ec)
+  {
+    const bool result = depth != 1 || derived().on_packet_bool(key, _b, _ec);
+    key.clear();
+    return result;
+  }
+
+  bool on_null(boost::json::error_code &)
+  {
+    key.clear();
+    return true;
+  }
+
+  bool on_comment_part(boost::json::string_view, boost::json::error_code &) { return true; }
+
+  bool on_comment(boost::json::string_view, boost::json::error_code &) { return true; }
+
+  // Hooks: Each returns false (after setting the error code) to stop parsing
+
+  /// Called before anything is parsed
+  bool on_packet_begin(boost::json::error_code &) { return true; }
+
+  /// Whether the top-level key names the list of entries
+  bool is_list(const std::string &) { return false; }
+
+  /// Called when an entry starts
+  bool on_entry_begin(boost::json::error_code &) { return true; }
+
+  /// Called when an entry ends
+  bool on_entry_end(boost::json::error_code &) { return true; }
+
+  /// Called for each number in an entry
+  bool on_entry_number(const std::string &, const double &, boost::json::error_code &)
+  {
+    return true;
+  }
+
+  /// Called for each number directly inside the list
+  bool on_list_number(const double &, boost::json::error_code &) { return true; }
+
+  /// Called for each top-level number
+  bool on_packet_number(const std::string &, const double &, boost::json::error_code &)
+  {
+    return true;
+  }
+
+  /// Called for each top-level boolean
+  bool on_packet_bool(const std::string &, const bool &, boost::json::error_code &)
+  {
+    return true;
+  }
+
+ protected:
+  /// Routes a number to the hook for where it is
+  bool on_number(const double &_value, boost::json::error_code &_ec)
+  {
+    bool result = true;
+    if (in_list && depth == 3) {
+      result = derived().on_entry_number(key, _value, _ec);
+    } else if (in_list && depth == 2) {
+      result = derived().on_list_number(_value, _ec);
+    } else if (depth == 1) {
+      result = derived().on_packet_number(key, _value, _ec);
+    }
+    key.clear();
+    return result;
+  }
+
+  Derived &derived() { return static_cast<Derived &>(*this); }
+
+  /// The nesting level: 1 is the packet itself, 3 is an entry
+  unsigned int depth = 0;
+
+  /// True while inside the list of entries
+  bool in_list = false;
+
+  /// The most recent key, cleared once its value is read
+  std::string key;
+};
+
+/**
+ * @class ResponseHandler
+ * @brief Reads a `fix arbfn` response (or waiting) packet, writing the force deltas straight
+ * into their final place.
+ */
+class ResponseHandler : public PacketHandler<ResponseHandler> {
+ public:
+  /// Where to write the deltas
+  DeltaView into = {nullptr, nullptr, nullptr, 0};
+
+  /// The number of atoms `into` can hold
+  size_t capacity = 0;
+
+  /// The number of atoms read so far
+  size_t count = 0;
+
+  /// The new `every` of the fix, or 0 if the packet did not set one
+  uintmax_t every = 0;
+
+  bool on_packet_begin(boost::json::error_code &)
+  {
+    count = 0;
+    every = 0;
+    return true;
+  }
+
+  bool is_list(const std::string &_key) { return _key == "atoms"; }
+
+  bool on_entry_begin(boost::json::error_code &_ec)
+  {
+    if (count >= capacity) {
+      _ec = boost::json::error::extra_data;
+      return false;
+    }
+    seen = 0;
+    return true;
+  }
+
+  bool on_entry_end(boost::json::error_code &_ec)
+  {
+    // Every atom must have all three deltas
+    if (seen != 7) {
+      _ec = boost::json::error::syntax;
+      return false;
+    }
+    ++count;
+    return true;
+  }
+
+  bool on_entry_number(const std::string &_key, const double &_value, boost::json::error_code &)
+  {
+    if (_key.size() == 3 && _key[0] == 'd' && _key[1] == 'f') {
+      const char axis = _key[2];
+      if (axis == 'x') {
+        into.dfx[count * into.stride] = _value, seen |= 1;
+      } else if (axis == 'y') {
+        into.dfy[count * into.stride] = _value, seen |= 2;
+      } else if (axis == 'z') {
+        into.dfz[count * into.stride] = _value, seen |= 4;
+      }
+    }
+    return true;
+  }
+
+  bool on_packet_number(const std::string &_key, const double &_value, boost::json::error_code &)
+  {
+    if (_key == "every" && _value >= 1.0) { every = _value; }
+    return true;
+  }
+
+ protected:
+  /// Bitmask of the deltas seen for the current atom
+  unsigned int seen = 0;
+};
+
+/**
+ * @class GridHandler
+ * @brief Reads a JSON ffield grid response (or one chunk of it), adding each node's deltas
+ * straight into the grid as it is parsed. Nodes may be listed with their indices ("nodes"), or
+ * densely as a flat list of deltas in x-major order ("deltas"), which carries on from where
+ * the last chunk stopped.
+ */
+class GridHandler : public PacketHandler<GridHandler> {
+ public:
+  /// The nodes to add into
+  NodeGrid *nodes = nullptr;
+
+  /// The number of nodes in x, y and z
+  const unsigned int *node_counts = nullptr;
+
+  /// True iff the controller will send more chunks
+  bool more = false;
+
+  /// True iff the controller sent a new `every`
+  bool has_every = false;
+
+  /// The new `every`, if any
+  uintmax_t every = 0;
+
+  /// The number of dense deltas read so far, over all chunks
+  uint64_t dense_count = 0;
+
+  /// A description of what went wrong, if anything
+  std::string error;
+
+  /// Prepares to read a new grid
+  void start(NodeGrid &_nodes, const unsigned int _node_counts[3])
+  {
+    nodes = &_nodes;
+    node_counts = _node_counts;
+    capacity = (uint64_t) 3 * _node_counts[0] * _node_counts[1] * _node_counts[2];
+    dense_count = 0;
+    x = y = z = 0;
+  }
+
+  bool on_packet_begin(boost::json::error_code &)
+  {
+    more = has_every = false;
+    error.clear();
+    return true;
+  }
+
+  bool is_list(const std::string &_key)
+  {
+    dense = _key == "deltas";
+    return dense || _key == "nodes";
+  }
+
+  bool on_list_number(const double &_value, boost::json::error_code &_ec)
+  {
+    if (!dense || dense_count == capacity) {
+      error = "too many deltas for a grid of " + std::to_string(capacity / 3) + " nodes";
+      _ec = boost::json::error::extra_data;
+      return false;
+    }
+
+    // Deltas arrive in x-major order, so the indices are just counted up
+    const unsigned int axis = dense_count++ % 3;
+    nodes->at(x, y, z)[axis] += _value;
+    if (axis == 2 && ++z == node_counts[2]) {
+      z = 0;
+      if (++y == node_counts[1]) { y = 0, ++x; }
+    }
+    return true;
+  }
+
+  bool on_entry_begin(boost::json::error_code &)
+  {
+    seen = 0;
+    return true;
+  }
+
+  bool on_entry_end(boost::json::error_code &_ec)
+  {
+    if (seen != 63) {
+      error = "node is missing an index or delta";
+      _ec = boost::json::error::syntax;
+      return false;
+    }
+
+    const double x = values[0], y = values[1], z = values[2];
+    if (!(x >= 0 && x < node_counts[0] && y >= 0 && y < node_counts[1] && z >= 0 &&
+          z < node_counts[2])) {
+      error = "invalid node (" + std::to_string(x) + ", " + std::to_string(y) + ", " +
+          std::to_string(z) + ")";
+      _ec = boost::json::error::syntax;
+      return false;
+    }
+
+    double *const node = nodes->at((long) x, (long) y, (long) z);
+    node[0] += values[3];
+    node[1] += values[4];
+    node[2] += values[5];
+    return true;
+  }
+
+  bool on_entry_number(const std::string &_key, const double &_value, boost::json::error_code &)
+  {
+    const char *const keys[] = {"xIndex", "yIndex", "zIndex", "dfx", "dfy", "dfz"};
+    for (int i = 0; i < 6; ++i) {
+      if (_key == keys[i]) {
+        values[i] = _value;
+        seen |= 1 << i;
+        break;
+      }
+    }
+    return true;
+  }
+
+  bool on_packet_number(const std::string &_key, const double &_value, boost::json::error_code &)
+  {
+    // Bonus feature: We can change the interval on the fly
+    if (_key == "every") {
+      has_every = true;
+      every = _value;
+    }
+    return true;
+  }
+
+  bool on_packet_bool(const std::string &_key, const bool &_value, boost::json::error_code &)
+  {
+    if (_key == "more") { more = _value; }
+    return true;
+  }
+
+ protected:
+  /// The indices and deltas of the current node
+  double values[6];
+
+  /// Bitmask of the values seen for the current node
+  unsigned int seen = 0;
+
+  /// True iff the current list is "deltas"
+  bool dense = false;
+
+  /// The number of deltas in the grid
+  uint64_t capacity = 0;
+
+  /// The node the next dense delta belongs to
+  unsigned int x = 0, y = 0, z = 0;
+};
+
+/**
+ * @brief Parses a JSON response or waiting packet straight into some fix data
+ * @param _packet The raw text of the packet
+ * @param _into Where to write the deltas
+ * @param _n The number of atoms `_into` can hold
+ * @param _type Where to save the type of the packet
+ * @param _count Where to save the number of atoms received
+ * @param _every Where to save the new `every` of the fix, if the packet set one
+ * @return True on success, false if the packet is malformed or holds too many atoms
+ */
+bool parse_response(const std::vector<char> &_packet, const DeltaView &_into, const size_t &_n,
+                    std::string &_type, size_t &_count, uintmax_t *_every = nullptr)
+{
+  // Reused between calls, so steady-state responses do not reallocate
+  static boost::json::basic_parser<ResponseHandler> parser((boost::json::parse_options()));
+  boost::json::error_code ec;
+
+  parser.reset();
+  parser.handler().into = _into;
+  parser.handler().capacity = _n;
+  parser.write_some(false, _packet.data(), _packet.size(), ec);
+
+  _type = parser.handler().type;
+  _count = parser.handler().count;
+  if (_every != nullptr && parser.handler().every != 0) { *_every = parser.handler().every; }
+  return !ec;
+}
+
+/**
+ * @brief Checks that this machine stores numbers in little-endian order, which the binary wire
+ * format requires.
+ * @return True iff binary packets can be read and written as-is
+ */
+bool host_is_little_endian()
+{
+  const uint16_t probe = 1;
+  return *(const uint8_t *) &probe == 1;
+}
+
+/**
+ * @brief Builds an MPI datatype describing a whole binary request packet in place: The header,
+ * then each column either straight from the memory it points into (see AtomColumn::source) or
+ * from its staged values. Nothing is copied until MPI sends it. All blocks are described as
+ * bytes, so the packet matches an MPI_BYTE receive.
+ * @param _n The number of atoms
+ * @param _columns The per-atom data, in wire order
+ * @param _header The header to send. Must outlive the datatype.
+ * @param _type Where to save the committed datatype, to be sent from MPI_BOTTOM. The caller
+ * must free it.
+ * @param _scratch Where to describe the datatype. Reusing it avoids allocating.
+ * @param _offsets The offsets of an aggregated request, sent after the columns. Must outlive
+ * the datatype.
+ */
+void request_type(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                  const BinaryHeader &_header, MPI_Datatype &_type, TypeScratch &_scratch,
+                  const std::vector<uint64_t> &_offsets = std::vector<uint64_t>())
+{
+  std::vector<int> &lengths = _scratch.lengths;
+  std::vector<MPI_Aint> &displacements = _scratch.displacements;
+  std::vector<MPI_Datatype> &types = _scratch.types;
+  std::vector<MPI_Aint> &atoms = _scratch.atoms;
+  MPI_Aint address;
+  lengths.clear();
+  displacements.clear();
+  types.clear();
+  atoms.resize(_n);
+
+  MPI_Get_address(&_header, &address);
+  lengths.push_back(sizeof(_header));
+  displacements.push_back(address);
+  types.push_back(MPI_BYTE);
+
+  for (const auto &column : _columns) {
+    const int block_size = column.width * sizeof(double);
+
+    if (column.source == nullptr) {
+      MPI_Get_address(column.values.data(), &address);
+      lengths.push_back(block_size * _n);
+      displacements.push_back(address);
+      types.push_back(MPI_BYTE);
+      continue;
+    }
+
+    // One block per atom, wherever it is in the source array
+    MPI_Get_address(column.source, &address);
+    for (size_t i = 0; i < _n; ++i) {
+      atoms[i] = address + (MPI_Aint) (column.stride * column.index[i] * sizeof(double));
+    }
+
+    MPI_Datatype scattered;
+    MPI_Type_create_hindexed_block(_n, block_size, atoms.data(), MPI_BYTE, &scattered);
+    lengths.push_back(1);
+    displacements.push_back(0);
+    types.push_back(scattered);
+  }
+
+  if (!_offsets.empty()) {
+    MPI_Get_address(_offsets.data(), &address);
+    lengths.push_back(_offsets.size() * sizeof(uint64_t));
+    displacements.push_back(address);
+    types.push_back(MPI_BYTE);
+  }
+
+  MPI_Type_create_struct(lengths.size(), lengths.data(), displacements.data(), types.data(),
+                         &_type);
+  MPI_Type_commit(&_type);
+
+  for (auto &type : types) {
+    if (type != MPI_BYTE) { MPI_Type_free(&type); }
+  }
+}
+
+/**
+ * @brief Builds an MPI datatype which receives a whole binary response packet in place: The
+ * header, then each (dfx, dfy, dfz) triple scattered straight into the given deltas.
+ * @param _n The number of atoms
+ * @param _header Where to receive the header
+ * @param _into Where to receive the deltas
+ * @param _type Where to save the committed datatype, to be received into MPI_BOTTOM. The caller
+ * must free it.
+ */
+void response_type(const size_t &_n, BinaryHeader &_header, const DeltaView &_into,
+                   MPI_Datatype &_type)
+{
+  MPI_Datatype triple, spaced, all;
+  MPI_Aint header_address, base, triple_displacements[3];
+
+  MPI_Get_address(&_header, &header_address);
+  MPI_Get_address(_into.dfx, &base);
+  MPI_Get_address(_into.dfy, &triple_displacements[1]);
+  MPI_Get_address(_into.dfz, &triple_displacements[2]);
+  triple_displacements[0] = 0;
+  triple_displacements[1] -= base;
+  triple_displacements[2] -= base;
+
+  // One atom's deltas, then the same for every atom `stride` doubles later
+  MPI_Type_create_hindexed_block(3, sizeof(double), triple_displacements, MPI_BYTE, &triple);
+  MPI_Type_create_resized(triple, 0, _into.stride * sizeof(double), &spaced);
+  MPI_Type_contiguous(_n, spaced, &all);
+
+  int lengths[2] = {(int) sizeof(_header), 1};
+  MPI_Aint displacements[2] = {header_address, base};
+  MPI_Datatype types[2] = {MPI_BYTE, all};
+  MPI_Type_create_struct(2, lengths, displacements, types, &_type);
+  MPI_Type_commit(&_type);
+
+  MPI_Type_free(&triple);
+  MPI_Type_free(&spaced);
+  MPI_Type_free(&all);
+}
+
+/**
+ * @brief Waits between two polls, as the given mode says
+ * @param _wait How to wait
+ */
+inline void pause(const WaitMode &_wait)
+{
+  if (_wait == ARBFN_WAIT_SLEEP) {
+    std::this_thread::sleep_for(std::chrono::microseconds(250));
+  } else if (_wait != ARBFN_WAIT_SPIN) {
+    std::this_thread::yield();
+  }
+}
+
+/**
+ * @brief Wait until an MPI packet is ready to be received, throwing an error if none arrives.
+ * The packet is matched, so it can only be received through `_message` (with MPI_Mrecv).
+ * @param _max_ms The max number of milliseconds to wait before error. If not positive, wait
+ * forever.
+ * @param _wait How to wait
+ * @param _source The rank to await a packet from, or MPI_ANY_SOURCE
+ * @param _message Where to save the matched message
+ * @param _status Where to save the status of the packet
+ * @param _comm The MPI communicator to use
+ * @return True on success, false on failure
+ */
+bool await_probe(const double &_max_ms, const WaitMode &_wait, const int &_source,
+                 MPI_Message &_message, MPI_Status &_status, MPI_Comm &_comm)
+{
+  // MPI cannot time out a blocking probe
+  if (_wait == ARBFN_WAIT_BLOCK && _max_ms <= 0.0) {
+    MPI_Mprobe(_source, MPI_ANY_TAG, _comm, &_message, &_status);
+    return true;
+  }
+
+  std::chrono::high_resolution_clock::time_point send_time, now;
+  uint64_t elapsed_us;
+  int flag;
+
+  send_time = std::chrono::high_resolution_clock::now();
+  while (true) {
+    // Check for message recv resolution
+    MPI_Improbe(_source, MPI_ANY_TAG, _comm, &flag, &_message, &_status);
+    if (flag) { return true; }
+
+    // Update time elapsed
+    now = std::chrono::high_resolution_clock::now();
+    elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(now - send_time).count();
+
+    // If it has been too long, indicate error
+    if (elapsed_us / 1000.0 > _max_ms && _max_ms > 0.0) {
+      // Indicate error
+      std::cerr << "Timeout!\n";
+      return false;
+    }
+
+    // Else, wait for a bit
+    pause(_wait);
+  }
+}
+
+/**
+ * @brief Await an MPI packet for some amount of time, throwing an error if none arrives.
+ * @param _max_ms The max number of milliseconds to wait before error
+ * @param _wait How to wait
+ * @param _into The buffer to save the raw packet into. This is resized to fit.
+ * @param _tag Where to save the MPI tag of the packet (ARBFN_JSON_TAG or ARBFN_BINARY_TAG)
+ * @param _received_from Where to save the MPI source of the sender
+ * @param _comm The MPI communicator to use
+ * @return True on success, false on failure
+ */
+bool await_packet(const double &_max_ms, const WaitMode &_wait, std::vector<char> &_into,
+                  int &_tag, unsigned int &_received_from, MPI_Comm &_comm)
+{
+  MPI_Message message;
+  MPI_Status status;
+  int count;
+
+  while (await_probe(_max_ms, _wait, MPI_ANY_SOURCE, message, status, _comm)) {
+    MPI_Get_count(&status, MPI_BYTE, &count);
+    _into.resize(count);
+    MPI_Mrecv(_into.data(), count, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+
+    // Empty packets carry no information, so they are dropped
+    if (count > 0) {
+      _tag = status.MPI_TAG;
+      _received_from = status.MPI_SOURCE;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Await a JSON MPI packet for some amount of time, throwing an error if none arrives.
+ * @param _max_ms The max number of milliseconds to wait before error
+ * @param _into The `boost::json` to save the packet into
+ * @param _received_from Where to save the MPI source of the sender
+ * @param _comm The MPI communicator to use
+ * @return True on success, false on failure
+ */
+bool await_packet(const double &_max_ms, boost::json::object &_into, unsigned int &_received_from,
+                  MPI_Comm &_comm)
+{
+  std::vector<char> buffer;
+  int tag;
+
+  if (!await_packet(_max_ms, ARBFN_WAIT_SLEEP, buffer, tag, _received_from, _comm)) {
+    return false;
+  }
+  if (tag != ARBFN_JSON_TAG) {
+    std::cerr << "Expected a JSON packet, but got one with tag " << tag << "\n";
+    return false;
+  }
+
+  // Unwrap packet
+  _into = boost::json::parse(boost::json::string_view(buffer.data(), buffer.size())).as_object();
+  return true;
+}
+
+/**
+ * @brief Send the given atom data, then receive the given fix data. This is blocking, but does not allow worker-side gridlocks.
+ * @param _n The number of atoms/fixes in the arrays.
+ * @param _from An array of atom data to send
+ * @param _into An array of fix data that was received
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @returns true on success, false on failure
+ */
+bool interchange(const size_t &_n, const AtomData _from[], FixData _into[], const double &_max_ms,
+                 const unsigned int &_controller_rank, MPI_Comm &_comm)
+{
+  return interchange(_n, _from, _into, _max_ms, _controller_rank, _comm, Handshake());
+}
+
+/**
+ * @brief Writes a JSON request packet
+ * @param _n The number of atoms.
+ * @param _columns The per-atom data to send
+ * @param _max_ms The max number of milliseconds the worker will await the response
+ * @param _into Where to write the packet. This is cleared first.
+ * @param _offsets If not empty, the index of the first atom from each aggregated rank
+ */
+void json_request(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                  const double &_max_ms, std::string &_into,
+                  const std::vector<uint64_t> &_offsets = std::vector<uint64_t>())
+{
+  _into.clear();
+  _into.append("{\"type\":\"request\",\"expectResponse\":");
+  append_double(_into, _max_ms);
+  _into.push_back(',');
+  if (!_offsets.empty()) {
+    _into.append("\"offsets\":[");
+    for (size_t i = 0; i < _offsets.size(); ++i) {
+      if (i != 0) { _into.push_back(','); }
+      append_int(_into, (int64_t) _offsets[i]);
+    }
+    _into.append("],");
+  }
+  append_atoms(_into, _n, _columns);
+  _into.push_back('}');
+}
+
+/**
+ * @brief Receives the JSON response to a request which was already sent, skipping any "waiting"
+ * packets.
+ * @param _n The number of atoms/fixes.
+ * @param _into Where to save the fix data that was received
+ * @param _max_ms The max number of milliseconds to await each packet
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _wait How to wait for the response
+ * @param _every Where to save the new `every` of the fix, if the controller sent one
+ * @returns true on success, false on failure
+ */
+bool json_response(const size_t &_n, const DeltaView &_into, const double &_max_ms,
+                   const unsigned int &_controller_rank, MPI_Comm &_comm, const WaitMode &_wait,
+                   uintmax_t *_every = nullptr)
+{
+  // Reused between calls, so steady-state responses do not reallocate
+  static std::vector<char> received;
+
+  unsigned int received_from;
+  std::string type;
+  size_t count;
+  int tag;
+
+  // Await response
+  while (true) {
+    // Await any sort of packet
+    if (!await_packet(_max_ms, _wait, received, tag, received_from, _comm)) {
+      std::cerr << "await_packet failed\n";
+      return false;
+    } else if (received_from != _controller_rank) {
+      continue;
+    } else if (tag != ARBFN_JSON_TAG) {
+      std::cerr << "Expected a JSON packet, but got one with tag " << tag << "\n";
+      return false;
+    }
+
+    // Deltas are written straight into `_into` as they are parsed
+    if (!parse_response(received, _into, _n, type, count, _every)) {
+      std::cerr << "Received malformed fix data from controller: Expected " << _n
+                << " atoms, but got more or an incomplete one\n";
+      return false;
+    }
+
+    // If "waiting" packet, continue. Else, break.
+    if (type == "waiting") {
+      continue;
+    } else if (type != "response") {
+      std::cerr << "Controller sent bad packet w/ type '" << type << "'\n";
+      return false;
+    }
+    break;
+  }
+
+  if (count != _n) {
+    std::cerr << "Received malformed fix data from controller: Expected " << _n
+              << " atoms, but got " << count << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Send the given atom columns as a JSON packet, then receive the given fix data.
+ * @param _n The number of atoms/fixes.
+ * @param _columns The per-atom data to send
+ * @param _into Where to save the fix data that was received
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _wait How to wait for the response
+ * @param _offsets If not empty, the index of the first atom from each aggregated rank
+ * @param _every Where to save the new `every` of the fix, if the controller sent one
+ * @returns true on success, false on failure
+ */
+bool json_interchange(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                      const DeltaView &_into, const double &_max_ms,
+                      const unsigned int &_controller_rank, MPI_Comm &_comm,
+                      const WaitMode &_wait,
+                      const std::vector<uint64_t> &_offsets = std::vector<uint64_t>(),
+                      uintmax_t *_every = nullptr)
+{
+  // Reused between calls, so steady-state requests do not reallocate
+  static std::string to_send;
+
+  json_request(_n, _columns, _max_ms, to_send, _offsets);
+  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, ARBFN_JSON_TAG, _comm);
+
+  return json_response(_n, _into, _max_ms, _controller_rank, _comm, _wait, _every);
+}
+
+/**
+ * @brief Writes the header of a binary request packet
+ * @param _n The number of atoms.
+ * @param _columns The per-atom data to send, in wire order
+ * @return The header
+ */
+BinaryHeader binary_request(const size_t &_n, const std::vector<AtomColumn> &_columns)
+{
+  BinaryHeader header;
+  header.magic = ARBFN_BINARY_MAGIC;
+  header.type = ARBFN_BINARY_REQUEST;
+  header.count = _n;
+  header.fields = 0;
+  header.segments = 0;
+  header.every = -1;
+  for (const auto &column : _columns) { header.fields |= column.field; }
+  return header;
+}
+
+/**
+ * @brief Receives the binary response to a request which was already sent, skipping any
+ * "waiting" packets. A response of the expected size is received straight into `_into`.
+ * @param _n The number of atoms/fixes.
+ * @param _into Where to save the fix data that was received
+ * @param _max_ms The max number of milliseconds to await each packet
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _wait How to wait for the response
+ * @param _every Where to save the new `every` of the fix, if the controller sent one
+ * @returns true on success, false on failure
+ */
+bool binary_response(const size_t &_n, const DeltaView &_into, const double &_max_ms,
+                     const unsigned int &_controller_rank, MPI_Comm &_comm,
+                     const WaitMode &_wait, uintmax_t *_every = nullptr)
+{
+  const size_t response_size = sizeof(BinaryHeader) + 3 * _n * sizeof(double);
+
+  std::vector<char> buffer;
+  MPI_Datatype type;
+  MPI_Message message;
+  MPI_Status status;
+  BinaryHeader header;
+  int count;
+
+  // Await response
+  while (true) {
+    if (!await_probe(_max_ms, _wait, MPI_ANY_SOURCE, message, status, _comm)) {
+      std::cerr << "await_packet failed\n";
+      return false;
+    }
+    MPI_Get_count(&status, MPI_BYTE, &count);
+
+    // The usual case: A response of exactly the right size goes straight into place
+    if (status.MPI_SOURCE == (int) _controller_rank && status.MPI_TAG == ARBFN_BINARY_TAG &&
+        (size_t) count == response_size) {
+      response_type(_n, header, _into, type);
+      MPI_Mrecv(MPI_BOTTOM, 1, type, &message, MPI_STATUS_IGNORE);
+      MPI_Type_free(&type);
+    } else {
+      buffer.resize(count);
+      MPI_Mrecv(buffer.data(), count, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+      if (count == 0 || status.MPI_SOURCE != (int) _controller_rank) { continue; }
+
+      // Controllers may always fall back on JSON for waiting packets
+      if (status.MPI_TAG == ARBFN_JSON_TAG) {
+        const boost::json::object json =
+            boost::json::parse(boost::json::string_view(buffer.data(), buffer.size()))
+                .as_object();
+        if (json.at("type") == "waiting") { continue; }
+        std::cerr << "Controller sent bad packet w/ type '" << json.at("type") << "'\n";
+        return false;
+      }
+
+      if (buffer.size() < sizeof(header)) {
+        std::cerr << "Controller sent truncated binary packet\n";
+        return false;
+      }
+      memcpy(&header, buffer.data(), sizeof(header));
+
+      // Oversized responses are allowed: Only the first n triples are read
+      if (header.magic == ARBFN_BINARY_MAGIC && header.type == ARBFN_BINARY_RESPONSE &&
+          header.count == _n && buffer.size() >= response_size) {
+        const double *triple = (const double *) (buffer.data() + sizeof(header));
+        for (size_t i = 0; i < _n; ++i, triple += 3) {
+          _into.dfx[i * _into.stride] = triple[0];
+          _into.dfy[i * _into.stride] = triple[1];
+          _into.dfz[i * _into.stride] = triple[2];
+        }
+      }
+    }
+
+    if (header.magic != ARBFN_BINARY_MAGIC) {
+      std::cerr << "Controller sent binary packet w/ bad magic number\n";
+      return false;
+    } else if (header.type == ARBFN_BINARY_WAITING) {
+      continue;
+    } else if (header.type != ARBFN_BINARY_RESPONSE) {
+      std::cerr << "Controller sent bad binary packet w/ type " << header.type << "\n";
+      return false;
+    } else if (header.count != _n || (size_t) count < response_size) {
+      std::cerr << "Received malformed fix data from controller: Expected " << _n
+                << " atoms, but got " << header.count << "\n";
+      return false;
+    }
+
+    if (_every != nullptr && header.every > 0) { *_every = header.every; }
+    return true;
+  }
+}
 
 /**
- * @brief Turn a JSON object into a std::string
- * @param _what The JSON to stringify
- * @return The string version
+ * @brief Send the given atom columns as a binary packet, then receive the given fix data. Both
+ * are done through MPI datatypes, so neither is staged in an intermediate buffer.
+ * @param _n The number of atoms/fixes.
+ * @param _columns The per-atom data to send, in wire order
+ * @param _into Where to save the fix data that was received
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _wait How to wait for the response
+ * @returns true on success, false on failure
  */
-std::string json_to_str(boost::json::value _what)
+bool binary_interchange(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                        const DeltaView &_into, const double &_max_ms,
+                        const unsigned int &_controller_rank, MPI_Comm &_comm,
+                        const WaitMode &_wait)
 {
-  std::stringstream s;
-  s << _what;
-  return s.str();
+  BinaryHeader header = binary_request(_n, _columns);
+  MPI_Datatype type;
+  TypeScratch scratch;
+
+  request_type(_n, _columns, header, type, scratch);
+  MPI_Send(MPI_BOTTOM, 1, type, _controller_rank, ARBFN_BINARY_TAG, _comm);
+  MPI_Type_free(&type);
+
+  return binary_response(_n, _into, _max_ms, _controller_rank, _comm, _wait);
+}
+
+bool interchange(const size_t &_n, const AtomData _from[], FixData _into[], const double &_max_ms,
+                 const unsigned int &_controller_rank, MPI_Comm &_comm,
+                 const Handshake &_handshake, const WaitMode &_wait)
+{
+  std::vector<AtomColumn> columns;
+  std::vector<std::string> fields = _handshake.fields;
+  if (fields.empty()) { fields = default_fields(_n > 0 && _from[0].is_dipole); }
+  sort_fields(fields);
+
+  if (!columns_from_atoms(_n, _from, fields, columns)) { return false; }
+  return interchange(_n, columns, _into, _max_ms, _controller_rank, _comm, _handshake, _wait);
+}
+
+bool collective_interchange(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                            double _deltas[], const unsigned int &_controller_rank,
+                            MPI_Comm &_comm)
+{
+  // Reused between calls, so steady-state requests do not reallocate
+  static std::vector<double> to_send;
+
+  int64_t header[2] = {(int64_t) _n, 0};
+  size_t width = 0;
+  for (const auto &column : _columns) {
+    header[1] |= column.field;
+    width += column.width;
+  }
+
+  to_send.resize(width * _n);
+  double *at = to_send.data();
+  for (const auto &column : _columns) {
+    for (size_t i = 0; i < _n; ++i) {
+      for (unsigned int k = 0; k < column.width; ++k) { *at++ = column_value(column, i, k); }
+    }
+  }
+
+  // Only the controller's counts and displacements matter
+  MPI_Gather(header, 2, MPI_INT64_T, nullptr, 2, MPI_INT64_T, _controller_rank, _comm);
+  MPI_Gatherv(to_send.data(), to_send.size(), MPI_DOUBLE, nullptr, nullptr, nullptr, MPI_DOUBLE,
+              _controller_rank, _comm);
+  MPI_Scatterv(nullptr, nullptr, nullptr, MPI_DOUBLE, _deltas, 3 * _n, MPI_DOUBLE,
+               _controller_rank, _comm);
+  return true;
 }
 
 /**
- * @brief Yields a string JSON version of the given atom
- * @param _what The atom to JSON-ify
- * @return The serialized version of the atom
+ * @brief As collective_interchange, but saving the deltas wherever the view says
+ * @param _n The number of atoms in each column
+ * @param _columns The per-atom data to send
+ * @param _into Where to save the force deltas
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @returns true on success, false on failure
  */
-boost::json::object to_json(const AtomData &_what)
+bool collective_interchange(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                            const DeltaView &_into, const unsigned int &_controller_rank,
+                            MPI_Comm &_comm)
+{
+  static std::vector<double> deltas;
+  deltas.resize(3 * _n);
+  if (!collective_interchange(_n, _columns, deltas.data(), _controller_rank, _comm)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < _n; ++i) {
+    _into.dfx[i * _into.stride] = deltas[i];
+    _into.dfy[i * _into.stride] = deltas[_n + i];
+    _into.dfz[i * _into.stride] = deltas[2 * _n + i];
+  }
+  return true;
+}
+
+bool interchange(const size_t &_n, const std::vector<AtomColumn> &_columns, FixData _into[],
+                 const double &_max_ms, const unsigned int &_controller_rank, MPI_Comm &_comm,
+                 const Handshake &_handshake, const WaitMode &_wait)
+{
+  static_assert(sizeof(FixData) == 3 * sizeof(double), "FixData must be a packed triple");
+
+  double *const first = (double *) _into;
+  const DeltaView view = {first, first + 1, first + 2, 3};
+
+  if (_handshake.collective) {
+    return collective_interchange(_n, _columns, view, _controller_rank, _comm);
+  }
+
+  if (_handshake.format == ARBFN_FORMAT_BINARY) {
+    return binary_interchange(_n, _columns, view, _max_ms, _controller_rank, _comm, _wait);
+  }
+  return json_interchange(_n, _columns, view, _max_ms, _controller_rank, _comm, _wait);
+}
+
+bool interchange(const size_t &_n, const std::vector<AtomColumn> &_columns, double _deltas[],
+                 const double &_max_ms, const unsigned int &_controller_rank, MPI_Comm &_comm,
+                 const Handshake &_handshake, const WaitMode &_wait)
+{
+  const DeltaView view = {_deltas, _deltas + _n, _deltas + 2 * _n, 1};
+
+  if (_handshake.collective) {
+    return collective_interchange(_n, _columns, _deltas, _controller_rank, _comm);
+  }
+  if (_handshake.format == ARBFN_FORMAT_BINARY) {
+    return binary_interchange(_n, _columns, view, _max_ms, _controller_rank, _comm, _wait);
+  }
+  return json_interchange(_n, _columns, view, _max_ms, _controller_rank, _comm, _wait);
+}
+
+void post_request(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                  const double &_max_ms, const unsigned int &_controller_rank, MPI_Comm &_comm,
+                  const Handshake &_handshake, PendingRequest &_into)
 {
-  boost::json::object j;
+  _into.n = _n;
+  _into.every = 0;
 
-  j["x"] = _what.x;
-  j["vx"] = _what.vx;
-  j["fx"] = _what.fx;
-  j["y"] = _what.y;
-  j["vy"] = _what.vy;
-  j["fy"] = _what.fy;
-  j["z"] = _what.z;
-  j["vz"] = _what.vz;
-  j["fz"] = _what.fz;
+  if (_handshake.format != ARBFN_FORMAT_BINARY) {
+    json_request(_n, _columns, _max_ms, _into.text);
+    MPI_Isend(_into.text.c_str(), _into.text.size(), MPI_CHAR, _controller_rank, ARBFN_JSON_TAG,
+              _comm, &_into.request);
+    return;
+  }
 
-  if (_what.is_dipole) {
-    j["mux"] = _what.mux;
-    j["muy"] = _what.muy;
-    j["muz"] = _what.muz;
+  // The send may outlive the caller's arrays, so columns read in place are staged
+  _into.columns = _columns;
+  for (auto &column : _into.columns) {
+    if (column.source == nullptr) { continue; }
+    column.values.resize(_n * column.width);
+    for (size_t i = 0; i < _n; ++i) {
+      for (unsigned int k = 0; k < column.width; ++k) {
+        column.values[i * column.width + k] = column_value(column, i, k);
+      }
+    }
+    column.source = nullptr;
+    column.index = nullptr;
   }
 
-  return j;
+  MPI_Datatype type;
+  TypeScratch scratch;
+  _into.header = binary_request(_n, _into.columns);
+  request_type(_n, _into.columns, _into.header, type, scratch);
+  MPI_Isend(MPI_BOTTOM, 1, type, _controller_rank, ARBFN_BINARY_TAG, _comm, &_into.request);
+  MPI_Type_free(&type);
+}
+
+bool collect_response(PendingRequest &_request, double _deltas[], const double &_max_ms,
+                      const unsigned int &_controller_rank, MPI_Comm &_comm,
+                      const Handshake &_handshake, const WaitMode &_wait)
+{
+  const size_t n = _request.n;
+  const DeltaView view = {_deltas, _deltas + n, _deltas + 2 * n, 1};
+
+  MPI_Wait(&_request.request, MPI_STATUS_IGNORE);
+
+  if (_handshake.format == ARBFN_FORMAT_BINARY) {
+    return binary_response(n, view, _max_ms, _controller_rank, _comm, _wait, &_request.every);
+  }
+  return json_response(n, view, _max_ms, _controller_rank, _comm, _wait, &_request.every);
 }
 
 /**
- * @brief Parses some JSON object into raw fix data.
- * @param _to_parse The JSON object to load from
- * @return The deserialized version of the object
+ * @brief Receives any JSON packets the controller sent while a binary response was awaited.
+ * These may only be "waiting" packets.
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @return True on success, false if the controller sent anything else
  */
-FixData from_json(const boost::json::value &_to_parse)
+bool skip_waiting(const unsigned int &_controller_rank, MPI_Comm &_comm)
 {
-  FixData f;
+  static std::vector<char> received;
+  MPI_Message message;
+  MPI_Status status;
+  std::string type;
+  size_t count;
+  int flag, size;
 
-  f.dfx = _to_parse.at("dfx").as_double();
-  f.dfy = _to_parse.at("dfy").as_double();
-  f.dfz = _to_parse.at("dfz").as_double();
+  while (true) {
+    MPI_Improbe(_controller_rank, ARBFN_JSON_TAG, _comm, &flag, &message, &status);
+    if (!flag) { return true; }
 
-  return f;
+    MPI_Get_count(&status, MPI_BYTE, &size);
+    received.resize(size);
+    MPI_Mrecv(received.data(), size, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+    if (size == 0) { continue; }
+
+    const DeltaView none = {nullptr, nullptr, nullptr, 0};
+    if (!parse_response(received, none, 0, type, count) || type != "waiting") {
+      std::cerr << "Controller sent bad packet w/ type '" << type << "'\n";
+      return false;
+    }
+  }
 }
 
 /**
- * @brief Await an MPI packet for some amount of time, throwing an error if none arrives.
- * @param _max_ms The max number of milliseconds to wait before error
- * @param _into The `boost::json` to save the packet into
- * @param _received_from Where to save the MPI source of the sender
+ * @brief Waits for a started receive to complete, throwing an error if it does not in time. On
+ * timeout, the receive is cancelled.
+ * @param _max_ms The max number of milliseconds to wait before error. If not positive, wait
+ * forever.
+ * @param _wait How to wait
+ * @param _request The started receive
+ * @param _status Where to save the status of the receive
+ * @param _controller_rank The rank of the controller within the provided communicator
  * @param _comm The MPI communicator to use
  * @return True on success, false on failure
  */
-bool await_packet(const double &_max_ms, boost::json::object &_into, unsigned int &_received_from,
-                  MPI_Comm &_comm)
+bool await_receive(const double &_max_ms, const WaitMode &_wait, MPI_Request &_request,
+                   MPI_Status &_status, const unsigned int &_controller_rank, MPI_Comm &_comm)
 {
-  bool got_any_packet;
-  std::chrono::high_resolution_clock::time_point send_time, now;
-  std::string response;
-  uint64_t elapsed_us;
-  MPI_Status status;
-  int flag;
-  char *buffer;
+  // Blocking cannot notice JSON waiting packets, so they are skipped afterwards
+  if (_wait == ARBFN_WAIT_BLOCK && _max_ms <= 0.0) {
+    MPI_Wait(&_request, &_status);
+    return skip_waiting(_controller_rank, _comm);
+  }
 
-  got_any_packet = false;
-  send_time = std::chrono::high_resolution_clock::now();
-  while (!got_any_packet) {
-    // Check for message recv resolution
-    MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, _comm, &flag, &status);
-    if (flag && status._ucount > 0) {
-      buffer = new char[status._ucount + 1];
-      MPI_Recv(buffer, status._ucount, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, _comm, &status);
-      buffer[status._ucount] = '\0';
-      response = buffer;
-      delete[] buffer;
-
-      got_any_packet = true;
-      _received_from = status.MPI_SOURCE;
+  const auto send_time = std::chrono::high_resolution_clock::now();
+  int flag;
 
-      break;
+  while (true) {
+    MPI_Test(&_request, &flag, &_status);
+    if (!skip_waiting(_controller_rank, _comm)) {
+      if (!flag) {
+        MPI_Cancel(&_request);
+        MPI_Wait(&_request, MPI_STATUS_IGNORE);
+      }
+      return false;
+    } else if (flag) {
+      return true;
     }
 
-    // Update time elapsed
-    now = std::chrono::high_resolution_clock::now();
-    elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(now - send_time).count();
-
-    // If it has been too long, indicate error
+    const auto now = std::chrono::high_resolution_clock::now();
+    const uint64_t elapsed_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(now - send_time).count();
     if (elapsed_us / 1000.0 > _max_ms && _max_ms > 0.0) {
-      // Indicate error
       std::cerr << "Timeout!\n";
+      MPI_Cancel(&_request);
+      MPI_Wait(&_request, MPI_STATUS_IGNORE);
       return false;
     }
 
-    // Else, sleep for a bit
-    std::this_thread::sleep_for(std::chrono::microseconds(250));
+    pause(_wait);
   }
+}
 
-  // Unwrap packet
-  _into = boost::json::parse(response).as_object();
-  return true;
+void free_exchange(PersistentExchange &_exchange)
+{
+  if (_exchange.send != MPI_REQUEST_NULL) { MPI_Request_free(&_exchange.send); }
+  if (_exchange.receive != MPI_REQUEST_NULL) { MPI_Request_free(&_exchange.receive); }
+  _exchange.capacity = 0;
 }
 
-/**
- * @brief Send the given atom data, then receive the given fix data. This is blocking, but does not allow worker-side gridlocks.
- * @param _n The number of atoms/fixes in the arrays.
- * @param _from An array of atom data to send
- * @param _into An array of fix data that was received
- * @param _max_ms The max number of milliseconds to await each response
- * @param _controller_rank The rank of the controller within the provided communicator
- * @param _comm The MPI communicator to use
- * @returns true on success, false on failure
- */
-bool interchange(const size_t &_n, const AtomData _from[], FixData _into[], const double &_max_ms,
-                 const unsigned int &_controller_rank, MPI_Comm &_comm)
+bool persistent_interchange(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                            double _deltas[], const double &_max_ms,
+                            const unsigned int &_controller_rank, MPI_Comm &_comm,
+                            const Handshake &_handshake, PersistentExchange &_exchange,
+                            const WaitMode &_wait, const std::vector<uint64_t> &_offsets)
 {
-  bool got_fix, result;
-  boost::json::object json_send, json_recv;
-  unsigned int received_from;
-  boost::json::array list;
-  std::string to_send;
+  if (_handshake.collective) {
+    return collective_interchange(_n, _columns, _deltas, _controller_rank, _comm);
+  }
+
+  // JSON packets have no predictable size
+  if (_handshake.format != ARBFN_FORMAT_BINARY) {
+    const DeltaView view = {_deltas, _deltas + _n, _deltas + 2 * _n, 1};
+    return json_interchange(_n, _columns, view, _max_ms, _controller_rank, _comm, _wait,
+                            _offsets, &_exchange.every);
+  }
 
-  // Prepare and send the packet
-  json_send["type"] = "request";
-  json_send["expectResponse"] = _max_ms;
-  for (size_t i = 0; i < _n; ++i) { list.push_back(to_json(_from[i])); }
-  json_send["atoms"] = list;
+  PersistentExchange &ex = _exchange;
+  ex.header = binary_request(_n, _columns);
+  ex.header.segments = _offsets.size();
 
-  to_send = json_to_str(json_send);
-  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, 0, _comm);
+  // Only re-initialize if the atoms outgrow the response buffer (or shrink far below it). It
+  // always keeps room for 64 atoms more than the response should hold, so a longer response is
+  // received whole enough to be reported as malformed below.
+  const size_t headroom = 64;
+  if (ex.receive == MPI_REQUEST_NULL || _n + headroom > ex.capacity ||
+      4 * (_n + headroom) < ex.capacity) {
+    free_exchange(ex);
+    ex.capacity = _n + _n / 4 + 2 * headroom;
+    ex.response.resize(sizeof(BinaryHeader) + 3 * ex.capacity * sizeof(double));
+    MPI_Recv_init(ex.response.data(), ex.response.size(), MPI_BYTE, _controller_rank,
+                  ARBFN_BINARY_TAG, _comm, &ex.receive);
+  }
 
-  // Await response
-  got_fix = false;
-  while (!got_fix) {
-    // Await any sort of packet
-    result = await_packet(_max_ms, json_recv, received_from, _comm);
-    if (!result) {
+  // The receive is posted first, so the response never waits in MPI's unexpected queue. The
+  // request is sent at its exact size, straight from the columns' memory.
+  MPI_Datatype type;
+  MPI_Start(&ex.receive);
+  request_type(_n, _columns, ex.header, type, ex.scratch, _offsets);
+  MPI_Isend(MPI_BOTTOM, 1, type, _controller_rank, ARBFN_BINARY_TAG, _comm, &ex.send);
+  MPI_Type_free(&type);
+
+  const size_t response_size = sizeof(BinaryHeader) + 3 * _n * sizeof(double);
+  bool result = false;
+  while (true) {
+    MPI_Status status;
+    BinaryHeader got;
+    int count;
+
+    if (!await_receive(_max_ms, _wait, ex.receive, status, _controller_rank, _comm)) {
       std::cerr << "await_packet failed\n";
-      return false;
-    } else if (received_from != _controller_rank) {
-      continue;
+      break;
+    }
+    MPI_Get_count(&status, MPI_BYTE, &count);
+    if ((size_t) count < sizeof(got)) {
+      std::cerr << "Controller sent truncated binary packet\n";
+      break;
     }
+    memcpy(&got, ex.response.data(), sizeof(got));
 
-    // If "waiting" packet, continue. Else, break.
-    if (json_recv.at("type") == "waiting") {
+    if (got.magic != ARBFN_BINARY_MAGIC) {
+      std::cerr << "Controller sent binary packet w/ bad magic number\n";
+      break;
+    } else if (got.type == ARBFN_BINARY_WAITING) {
+      MPI_Start(&ex.receive);
       continue;
-    } else {
-      if (json_recv["type"] != "response") {
-        std::cerr << "Controller sent bad packet w/ type '" << json_recv["type"] << "'\n";
-        return false;
-      }
-      got_fix = true;
+    } else if (got.type != ARBFN_BINARY_RESPONSE) {
+      std::cerr << "Controller sent bad binary packet w/ type " << got.type << "\n";
+      break;
+    } else if (got.count != _n) {
+      std::cerr << "Received malformed fix data from controller: Expected " << _n
+                << " atoms, but got " << got.count << "\n";
+      break;
+    } else if ((size_t) count != response_size) {
+      std::cerr << "Received malformed fix data from controller: Expected " << response_size
+                << " bytes, but got " << count << "\n";
       break;
     }
+
+    if (got.every > 0) { ex.every = got.every; }
+
+    // Unpack the triples into structure-of-arrays order
+    const char *triple = ex.response.data() + sizeof(got);
+    for (size_t i = 0; i < _n; ++i, triple += 3 * sizeof(double)) {
+      memcpy(&_deltas[i], triple, sizeof(double));
+      memcpy(&_deltas[_n + i], triple + sizeof(double), sizeof(double));
+      memcpy(&_deltas[2 * _n + i], triple + 2 * sizeof(double), sizeof(double));
+    }
+    result = true;
+    break;
   }
 
-  // Transcribe fix data
-  if (json_recv.at("atoms").as_array().size() != _n) {
-    std::cerr << "Received malformed fix data from controller: Expected " << _n
-              << " atoms, but got " << json_recv.at("atoms").as_array().size() << "\n";
+  // A controller which never answered may never receive the request either, and a started send
+  // cannot reliably be cancelled. The caller gives up on failure, so the send is just let go.
+  if (!result) {
+    MPI_Request_free(&ex.send);
     return false;
   }
-  for (size_t i = 0; i < _n; ++i) { _into[i] = from_json(json_recv.at("atoms").as_array().at(i)); }
-
+  MPI_Wait(&ex.send, MPI_STATUS_IGNORE);
   return true;
 }
 
 /**
- * @brief Sends a registration packet to the controller.
+ * @brief Finds the ranks of `_comm` which are not in `_workers`. Only local group operations
+ * are used, so no rank sends or receives anything.
+ * @param _comm The ARBFN communicator
+ * @param _workers A communicator holding exactly the registering workers
+ * @param _into Where to save the ranks (in `_comm`) of every possible controller
+ */
+void find_controllers(MPI_Comm &_comm, const MPI_Comm &_workers, std::vector<int> &_into)
+{
+  MPI_Group everyone, workers, others;
+  int count;
+
+  MPI_Comm_group(_comm, &everyone);
+  MPI_Comm_group(_workers, &workers);
+  MPI_Group_difference(everyone, workers, &others);
+  MPI_Group_size(others, &count);
+
+  std::vector<int> ranks(count);
+  for (int i = 0; i < count; ++i) { ranks[i] = i; }
+  _into.resize(count);
+  if (count > 0) { MPI_Group_translate_ranks(others, count, ranks.data(), everyone, _into.data()); }
+
+  MPI_Group_free(&others);
+  MPI_Group_free(&workers);
+  MPI_Group_free(&everyone);
+}
+
+/**
+ * @brief Sends a registration packet to every possible controller and waits for an ack.
+ * @param _controller_rank Where to save the rank of the controller
+ * @param _comm The communicator to use
+ * @param _candidates The ranks to register with. If empty, every other rank is used.
+ * @param _offer_binary Whether to offer the controller the binary wire format
+ * @param _handshake Where to save the negotiated settings
+ * @param _shard If not negative, the index of the one candidate among `_shards` controllers
+ * @param _shards The number of controllers sharing the workers
+ * @param _offer_collective Whether to offer the collective mode
  * @return True on success, false on error.
  */
-bool send_registration(unsigned int &_controller_rank, MPI_Comm &_comm)
+bool register_with_controller(unsigned int &_controller_rank, MPI_Comm &_comm,
+                              const std::vector<int> &_candidates, const bool &_offer_binary,
+                              Handshake &_handshake, const int &_shard = -1,
+                              const int &_shards = 0, const bool &_offer_collective = false)
 {
   boost::json::object json;
   std::string to_send;
@@ -203,10 +1553,23 @@ bool send_registration(unsigned int &_controller_rank, MPI_Comm &_comm)
   MPI_Comm_size(_comm, &world_size);
 
   json["type"] = "register";
+  if (_offer_binary) { json["formats"] = boost::json::array({"json", "binary"}); }
+  if (_shard >= 0) {
+    json["shard"] = _shard;
+    json["shards"] = _shards;
+  }
+  if (_offer_collective) { json["collective"] = true; }
   to_send = json_to_str(json);
 
-  for (int i = 0; i < world_size; ++i) {
-    if (i != rank) { MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, i, 0, _comm); }
+  if (!_candidates.empty()) {
+    for (const int &i : _candidates) {
+      MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, i, 0, _comm);
+    }
+  } else {
+    // Without a workers communicator, any other rank may be the controller
+    for (int i = 0; i < world_size; ++i) {
+      if (i != rank) { MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, i, 0, _comm); }
+    }
   }
 
   json.clear();
@@ -215,9 +1578,74 @@ bool send_registration(unsigned int &_controller_rank, MPI_Comm &_comm)
     if (!result) { return false; }
   } while (!json.contains("type") || json.at("type") != "ack");
 
+  // Controllers which predate format negotiation will not pick one
+  _handshake.format = ARBFN_FORMAT_JSON;
+  if (_offer_binary && json.contains("format") && json.at("format") == "binary") {
+    _handshake.format = ARBFN_FORMAT_BINARY;
+  }
+
+  // Only a controller which knows every other rank is a worker may choose the collective mode
+  _handshake.collective = _offer_collective && json.contains("collective") &&
+      json.at("collective").is_bool() && json.at("collective").as_bool();
+
+  // The controller may ask for only some per-atom fields
+  _handshake.fields.clear();
+  if (json.contains("fields")) {
+    for (const auto &field : json.at("fields").as_array()) {
+      _handshake.fields.push_back(std::string(field.as_string().c_str()));
+    }
+  }
+
   return true;
 }
 
+/**
+ * @brief Sends a registration packet to the controller.
+ * @return True on success, false on error.
+ */
+bool send_registration(unsigned int &_controller_rank, MPI_Comm &_comm)
+{
+  Handshake handshake;
+  return register_with_controller(_controller_rank, _comm, std::vector<int>(), false, handshake);
+}
+
+/**
+ * @brief Sends a registration packet to the controller, offering every wire format this worker
+ * supports.
+ * @return True on success, false on error.
+ */
+bool send_registration(unsigned int &_controller_rank, MPI_Comm &_comm, Handshake &_handshake)
+{
+  return register_with_controller(_controller_rank, _comm, std::vector<int>(),
+                                  host_is_little_endian(), _handshake);
+}
+
+/**
+ * @brief Sends a registration packet only to the ranks outside `_workers` (or only to one of
+ * them, if sharded), offering every wire format this worker supports.
+ * @return True on success, false on error.
+ */
+bool send_registration(unsigned int &_controller_rank, MPI_Comm &_comm, Handshake &_handshake,
+                       const MPI_Comm &_workers, const double &_shard,
+                       const bool &_offer_collective)
+{
+  std::vector<int> candidates;
+  find_controllers(_comm, _workers, candidates);
+  if (_shard < 0.0 || candidates.size() <= 1) {
+    // Collectives need every rank, so the one candidate must be the controller
+    const bool offer_collective = _offer_collective && candidates.size() == 1;
+    return register_with_controller(_controller_rank, _comm, candidates, host_is_little_endian(),
+                                    _handshake, -1, 0, offer_collective);
+  }
+
+  // Every candidate is a controller, and this worker belongs to exactly one
+  const int shards = candidates.size();
+  const int shard = std::min(std::max((int) (_shard * shards), 0), shards - 1);
+  return register_with_controller(_controller_rank, _comm,
+                                  std::vector<int>(1, candidates[shard]),
+                                  host_is_little_endian(), _handshake, shard, shards);
+}
+
 /**
  * @brief Sends a deregistration packet to the controller.
  */
@@ -227,6 +1655,79 @@ void send_deregistration(const int &_controller_rank, MPI_Comm &_comm)
   MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, 0, _comm);
 }
 
+/**
+ * @brief Deregisters from the controller: In the collective mode, by joining the gather of atom
+ * counts with a count of -1.
+ */
+void send_deregistration(const int &_controller_rank, MPI_Comm &_comm,
+                         const Handshake &_handshake)
+{
+  if (!_handshake.collective) {
+    send_deregistration(_controller_rank, _comm);
+    return;
+  }
+
+  int64_t header[2] = {-1, 0};
+  MPI_Gather(header, 2, MPI_INT64_T, nullptr, 2, MPI_INT64_T, _controller_rank, _comm);
+}
+
+/**
+ * @brief Writes a gridRequest packet
+ * @param _start A 3-tuple (x, y, z) of the lowest corner of the simulation box.
+ * @param _bin_widths A 3-tuple for the x, y, and z spacing of the nodes.
+ * @param _node_counts The number of nodes per side. A 3-tuple of the x, y, and z.
+ * @param _atoms_to_send_size The number of atoms in each column. If 0, don't send any atoms.
+ * @param _columns The per-atom data to send to the controller
+ * @param _compression The compression to ask for. Nothing is asked for by default.
+ * @param _streamed If true, the grid may be sent over several messages (chunks) and, if
+ * `_compression.dense`, without indices
+ * @return The packet text
+ */
+std::string grid_request(const double _start[3], const double _bin_widths[3],
+                         const unsigned int _node_counts[3], const size_t &_atoms_to_send_size,
+                         const std::vector<AtomColumn> &_columns,
+                         const GridCompression &_compression, const bool &_streamed)
+{
+  std::string to_send = "{\"type\":\"gridRequest\",\"offset\":[";
+  for (int i = 0; i < 3; ++i) {
+    if (i != 0) { to_send.push_back(','); }
+    append_double(to_send, _start[i]);
+  }
+  to_send.append("],\"spacing\":[");
+  for (int i = 0; i < 3; ++i) {
+    if (i != 0) { to_send.push_back(','); }
+    append_double(to_send, _bin_widths[i]);
+  }
+  to_send.append("],\"nodeCounts\":[");
+  for (int i = 0; i < 3; ++i) {
+    if (i != 0) { to_send.push_back(','); }
+    append_int(to_send, _node_counts[i]);
+  }
+  to_send.push_back(']');
+
+  // Optional section to ask for a binary grid
+  if (_compression.encoding != ARBFN_GRID_FLOAT64 || _compression.deflate) {
+    to_send.append(",\"compression\":{\"encoding\":\"");
+    to_send.append(grid_encoding_name(_compression.encoding));
+    to_send.append("\",\"tolerance\":");
+    append_double(to_send, _compression.tolerance);
+    to_send.append(_compression.deflate ? ",\"deflate\":true}" : ",\"deflate\":false}");
+  }
+
+  // The grid may be sent in chunks (EG one x-plane per message), and without indices
+  if (_streamed) { to_send.append(",\"chunks\":true"); }
+  if (_streamed && _compression.dense) { to_send.append(",\"dense\":true"); }
+
+  // Optional section to send atom information
+  if (_atoms_to_send_size > 0) {
+    to_send.push_back(',');
+    append_atoms(to_send, _atoms_to_send_size, _columns);
+  }
+  to_send.push_back('}');
+
+  return to_send;
+}
+
 std::list<FFieldNodeData> ffield_interchange(const double _start[3], const double _bin_widths[3],
                                              const unsigned int _node_counts[3],
                                              const unsigned int &_controller_rank, MPI_Comm &_comm,
@@ -234,25 +1735,24 @@ std::list<FFieldNodeData> ffield_interchange(const double _start[3], const doubl
                                              const unsigned int &_atoms_to_send_size,
                                              const AtomData _atoms_to_send[])
 {
-  boost::json::object to_send;
-
-  to_send["type"] = "gridRequest";
-  to_send["offset"] = boost::json::array({_start[0], _start[1], _start[2]});
-  to_send["spacing"] = boost::json::array({_bin_widths[0], _bin_widths[1], _bin_widths[2]});
-  to_send["nodeCounts"] = boost::json::array({_node_counts[0], _node_counts[1], _node_counts[2]});
-
-  // Optional section to send atom information
+  std::vector<AtomColumn> columns;
   if (_atoms_to_send_size > 0) {
-    boost::json::array list;
-    for (size_t i = 0; i < _atoms_to_send_size; ++i) { list.push_back(to_json(_atoms_to_send[i])); }
-    to_send["atoms"] = list;
+    columns_from_atoms(_atoms_to_send_size, _atoms_to_send,
+                       default_fields(_atoms_to_send[0].is_dipole), columns);
   }
+  return ffield_interchange(_start, _bin_widths, _node_counts, _controller_rank, _comm, _every,
+                            _atoms_to_send_size, columns);
+}
 
-  std::stringstream to_send_strm;
-  to_send_strm << to_send;
-  const std::string to_send_string = to_send_strm.str();
-
-  MPI_Send(to_send_string.c_str(), to_send_string.size(), MPI_CHAR, _controller_rank, 0, _comm);
+std::list<FFieldNodeData> ffield_interchange(const double _start[3], const double _bin_widths[3],
+                                             const unsigned int _node_counts[3],
+                                             const unsigned int &_controller_rank, MPI_Comm &_comm,
+                                             uintmax_t &_every, const size_t &_atoms_to_send_size,
+                                             const std::vector<AtomColumn> &_columns)
+{
+  const std::string to_send = grid_request(_start, _bin_widths, _node_counts, _atoms_to_send_size,
+                                           _columns, GridCompression(), false);
+  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, 0, _comm);
 
   MPI_Status status;
   MPI_Probe(_controller_rank, 0, _comm, &status);
@@ -287,3 +1787,114 @@ std::list<FFieldNodeData> ffield_interchange(const double _start[3], const doubl
 
   return out;
 }
+
+bool ffield_interchange(const double _start[3], const double _bin_widths[3],
+                        const unsigned int _node_counts[3], const unsigned int &_controller_rank,
+                        MPI_Comm &_comm, uintmax_t &_every, const size_t &_atoms_to_send_size,
+                        const std::vector<AtomColumn> &_columns,
+                        const GridCompression &_compression, NodeGrid &_nodes,
+                        const WaitMode &_wait)
+{
+  const std::string to_send = grid_request(_start, _bin_widths, _node_counts, _atoms_to_send_size,
+                                           _columns, _compression, true);
+  MPI_Send(to_send.c_str(), to_send.size(), MPI_CHAR, _controller_rank, ARBFN_JSON_TAG, _comm);
+
+  const uint64_t expected = (uint64_t) _node_counts[0] * _node_counts[1] * _node_counts[2];
+  uint64_t received = 0;
+  bool more = true;
+
+  // The grid may arrive in several chunks, each of which is added into the nodes as soon as it
+  // arrives. Thus only one chunk is held at a time, however large the grid is.
+  static std::vector<char> buffer;
+  boost::json::basic_parser<GridHandler> parser((boost::json::parse_options()));
+  parser.handler().start(_nodes, _node_counts);
+
+  while (more) {
+    MPI_Message message;
+    MPI_Status status;
+    int count;
+    await_probe(0.0, _wait, _controller_rank, message, status, _comm);
+    MPI_Get_count(&status, MPI_BYTE, &count);
+    if (count == MPI_UNDEFINED || count < 0) {
+      std::cerr << "Controller sent a grid chunk too large to receive; send smaller chunks\n";
+      return false;
+    }
+
+    buffer.resize(count);
+    MPI_Mrecv(buffer.data(), count, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+
+    // Binary grids are decoded straight into the nodes
+    if (status.MPI_TAG == ARBFN_BINARY_TAG) {
+      GridHeader header;
+      std::string error;
+      bool in_bounds = true;
+      uint64_t next = expected;
+      unsigned int x = 0, y = 0, z = 0;
+
+      // Nodes arrive in x-major order, so the indices are just counted up from the first
+      const bool result = decode_grid(
+          buffer.data(), buffer.size(), header,
+          [&](const uint64_t &_index, const double &_dfx, const double &_dfy,
+              const double &_dfz) {
+            if (_index >= expected) {
+              in_bounds = false;
+              return;
+            }
+            if (_index != next) {
+              x = _index / ((uint64_t) _node_counts[1] * _node_counts[2]);
+              y = (_index / _node_counts[2]) % _node_counts[1];
+              z = _index % _node_counts[2];
+            }
+            next = _index + 1;
+
+            double *const node = _nodes.at(x, y, z);
+            node[0] += _dfx;
+            node[1] += _dfy;
+            node[2] += _dfz;
+            if (++z == _node_counts[2]) {
+              z = 0;
+              if (++y == _node_counts[1]) { y = 0, ++x; }
+            }
+          },
+          error);
+
+      if (result && (!in_bounds || header.total != expected)) {
+        error = "expected " + std::to_string(expected) + " nodes, but got a grid of " +
+            std::to_string(header.total);
+      }
+      if (!result || !in_bounds || header.total != expected) {
+        std::cerr << "Controller sent bad grid: " << error << "\n";
+        return false;
+      }
+
+      if (header.every >= 0) { _every = header.every; }
+      received += header.count;
+      more = received < expected;
+      continue;
+    }
+
+    boost::json::error_code ec;
+    parser.reset();
+    parser.write_some(false, buffer.data(), buffer.size(), ec);
+    if (ec) {
+      std::cerr << "Controller sent bad grid: "
+                << (parser.handler().error.empty() ? ec.message() : parser.handler().error)
+                << "\n";
+      return false;
+    }
+
+    if (parser.handler().has_every) { _every = parser.handler().every; }
+    more = parser.handler().more;
+  }
+
+  // Dense grids are checked once, at the end
+  const uint64_t dense_count = parser.handler().dense_count;
+  if (dense_count != 0 && dense_count != 3 * expected) {
+    std::cerr << "Controller sent bad grid: expected " << 3 * expected << " deltas, but got "
+              << dense_count << "\n";
+    return false;
+  }
+
+  _nodes.fill_ghosts();
+  return true;
+}
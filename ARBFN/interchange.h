@@ -6,17 +6,213 @@
 #ifndef ARBFN_INTERCHANGE_H
 #define ARBFN_INTERCHANGE_H
 
+#include <algorithm>
 #include <cstdint>
 #include <list>
 #include <mpi.h>
+#include <string>
+#include <vector>
 
-#define FIX_ARBFN_VERSION "0.3.0"
+#define FIX_ARBFN_VERSION "0.4.0"
 
 /**
  * @brief The color all ARBFN comms will be expected to have
  */
 const static int ARBFN_MPI_COLOR = 56789;
 
+/**
+ * @brief The MPI tag used for JSON (text) packets
+ */
+const static int ARBFN_JSON_TAG = 0;
+
+/**
+ * @brief The MPI tag used for packed binary packets
+ */
+const static int ARBFN_BINARY_TAG = 1;
+
+/**
+ * @brief The first 4 bytes of every binary packet ("ARBF" in
+ * little-endian order)
+ */
+const static uint32_t ARBFN_BINARY_MAGIC = 0x46425241;
+
+/// Binary field bit: positions (x, y, z)
+const static uint64_t ARBFN_FIELD_X = 1 << 0;
+
+/// Binary field bit: velocities (vx, vy, vz)
+const static uint64_t ARBFN_FIELD_V = 1 << 1;
+
+/// Binary field bit: forces (fx, fy, fz)
+const static uint64_t ARBFN_FIELD_F = 1 << 2;
+
+/// Binary field bit: dipole orientations (mux, muy, muz)
+const static uint64_t ARBFN_FIELD_MU = 1 << 3;
+
+/// Binary field bit: atom types
+const static uint64_t ARBFN_FIELD_TYPE = 1 << 4;
+
+/// Binary field bit: atom IDs
+const static uint64_t ARBFN_FIELD_TAG = 1 << 5;
+
+/// Binary field bit: charges
+const static uint64_t ARBFN_FIELD_Q = 1 << 6;
+
+/// Binary field bit: `fix property/atom` vectors, in the order the controller asked for them
+const static uint64_t ARBFN_FIELD_CUSTOM = 1 << 7;
+
+/**
+ * @enum WireFormat
+ * @brief The encodings which a worker and its controller can
+ * agree upon for request and response packets
+ */
+enum WireFormat {
+  /// Human-readable JSON strings (the default)
+  ARBFN_FORMAT_JSON = 0,
+
+  /// Packed little-endian doubles (see BinaryHeader)
+  ARBFN_FORMAT_BINARY = 1
+};
+
+/**
+ * @enum WaitMode
+ * @brief How a worker waits for packets from its controller
+ */
+enum WaitMode {
+  /// Poll as fast as possible. Lowest latency, but uses a whole core
+  ARBFN_WAIT_SPIN = 0,
+
+  /// Poll, yielding the core to other threads between polls
+  ARBFN_WAIT_YIELD = 1,
+
+  /// Poll, sleeping 250us between polls (the default)
+  ARBFN_WAIT_SLEEP = 2,
+
+  /// Block in MPI_Mprobe. With a timeout, this polls like yield
+  ARBFN_WAIT_BLOCK = 3
+};
+
+/**
+ * @brief Parses the name of a WaitMode (EG from a fix keyword)
+ * @param _name "spin", "yield", "sleep" or "block"
+ * @param _into Where to save the mode
+ * @return True on success, false if the name is unknown
+ */
+inline bool wait_mode_from_name(const std::string &_name, WaitMode &_into)
+{
+  const char *const names[] = {"spin", "yield", "sleep", "block"};
+  for (int i = 0; i < 4; ++i) {
+    if (_name == names[i]) {
+      _into = (WaitMode) i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @enum BinaryPacketType
+ * @brief The `type` of a binary packet
+ */
+enum BinaryPacketType {
+  /// Worker to controller: Atom data for this step
+  ARBFN_BINARY_REQUEST = 1,
+
+  /// Controller to worker: Force deltas for a request
+  ARBFN_BINARY_RESPONSE = 2,
+
+  /// Controller to worker: The response is not ready yet
+  ARBFN_BINARY_WAITING = 3,
+
+  /// Controller to worker: An encoded ffield grid (see grid_codec.h)
+  ARBFN_BINARY_GRID = 4
+};
+
+/**
+ * @struct BinaryHeader
+ * @brief Prefixes every binary packet. A request is followed by
+ * one block of doubles for each bit set in `fields`, in
+ * increasing bit order: `count` (x, y, z)-ordered triples for
+ * x/v/f/mu, or `count` single values for the others. The custom
+ * bit stands for one block per `fix property/atom` vector. A
+ * response is followed by `count` (dfx, dfy, dfz) triples. An
+ * aggregated request's blocks are followed by `segments` uint64
+ * offsets. All numbers are little-endian.
+ */
+struct BinaryHeader {
+  /// Always ARBFN_BINARY_MAGIC
+  uint32_t magic;
+
+  /// One of BinaryPacketType
+  uint32_t type;
+
+  /// The number of atoms in the packet
+  uint64_t count;
+
+  /// Bitmask of ARBFN_FIELD_* values present (requests). Zero in
+  /// responses.
+  uint64_t fields;
+
+  /// The number of per-rank offsets after the blocks of an
+  /// aggregated request. Otherwise zero.
+  uint64_t segments;
+
+  /// In a response, the new `every` of the fix, or -1 to leave it
+  /// as-is (as in GridHeader). Always -1 in requests.
+  int64_t every;
+};
+
+/**
+ * @struct Handshake
+ * @brief The settings a worker and controller agreed upon during
+ * registration
+ */
+struct Handshake {
+  /// The encoding to use for requests and responses
+  WireFormat format = ARBFN_FORMAT_JSON;
+
+  /// The per-atom fields the controller asked for (EG "x",
+  /// "type" or "d_name"). If empty, the defaults are sent.
+  std::vector<std::string> fields;
+
+  /// If true, requests and responses are collectives over the
+  /// whole communicator (see collective_interchange)
+  bool collective = false;
+};
+
+/**
+ * @struct AtomColumn
+ * @brief One per-atom quantity to be sent to the controller
+ */
+struct AtomColumn {
+  /// The field name, as the controller would ask for it
+  std::string name;
+
+  /// The ARBFN_FIELD_* bit of this field
+  uint64_t field;
+
+  /// The number of components per atom: 3 for x/v/f/mu, else 1
+  unsigned int width;
+
+  /// Whether the values are integers (sent as such in JSON)
+  bool is_integer;
+
+  /// For custom fields, the index of the `fix property/atom` vector
+  int custom_index = -1;
+
+  /// `width` values per atom, one atom after another
+  std::vector<double> values;
+
+  /// If not null, `values` is unused and component k of atom i is instead read in place from
+  /// `source[stride * index[i] + k]`. The binary format then sends straight from this memory.
+  const double *source = nullptr;
+
+  /// The number of doubles between atoms in `source`
+  unsigned int stride = 0;
+
+  /// The position of each atom in `source`
+  const int *index = nullptr;
+};
+
 /**
  * @struct AtomData
  * @brief Represents a single atom to be transferred
@@ -101,6 +297,93 @@ struct FFieldNodeData {
   double dfz;
 };
 
+/**
+ * @brief Maps a field name from a controller's ack to its ARBFN_FIELD_* bit
+ * @param _name The field name (EG "x", "type" or "d_name")
+ * @return The bit, or 0 if the name is unknown
+ */
+inline uint64_t field_bit(const std::string &_name)
+{
+  if (_name == "x") {
+    return ARBFN_FIELD_X;
+  } else if (_name == "v") {
+    return ARBFN_FIELD_V;
+  } else if (_name == "f") {
+    return ARBFN_FIELD_F;
+  } else if (_name == "mu") {
+    return ARBFN_FIELD_MU;
+  } else if (_name == "type") {
+    return ARBFN_FIELD_TYPE;
+  } else if (_name == "tag") {
+    return ARBFN_FIELD_TAG;
+  } else if (_name == "q") {
+    return ARBFN_FIELD_Q;
+  } else if (_name.size() > 2 &&
+             (_name.compare(0, 2, "d_") == 0 || _name.compare(0, 2, "i_") == 0)) {
+    return ARBFN_FIELD_CUSTOM;
+  }
+  return 0;
+}
+
+/**
+ * @brief Gives the fields that are sent if the controller does not ask for any
+ * @param _is_dipole Whether to include mu
+ * @return The field names, in wire order
+ */
+inline std::vector<std::string> default_fields(const bool &_is_dipole)
+{
+  std::vector<std::string> out = {"x", "v", "f"};
+  if (_is_dipole) { out.push_back("mu"); }
+  return out;
+}
+
+/**
+ * @brief Creates an empty column for the given field
+ * @param _name The field name (EG "x", "type" or "d_name")
+ * @return The column, with no values
+ */
+inline AtomColumn make_column(const std::string &_name)
+{
+  AtomColumn out;
+  out.name = _name;
+  out.field = field_bit(_name);
+  const uint64_t vector_fields = ARBFN_FIELD_X | ARBFN_FIELD_V | ARBFN_FIELD_F | ARBFN_FIELD_MU;
+  out.width = (out.field & vector_fields) ? 3 : 1;
+  out.is_integer = out.field == ARBFN_FIELD_TYPE || out.field == ARBFN_FIELD_TAG ||
+      _name.compare(0, 2, "i_") == 0;
+  return out;
+}
+
+/**
+ * @brief Gives the JSON key of one component of a column
+ * @param _column The column
+ * @param _component Which component (0, 1 or 2 for x, y or z)
+ * @return The key, EG "x", "vy" or "type"
+ */
+inline std::string column_key(const AtomColumn &_column, const unsigned int &_component)
+{
+  const char *const axes[] = {"x", "y", "z"};
+  if (_column.width == 1) {
+    return _column.name;
+  } else if (_column.field == ARBFN_FIELD_X) {
+    return axes[_component];
+  }
+  return _column.name + axes[_component];
+}
+
+/**
+ * @brief Sorts field names into wire order: By ARBFN_FIELD_* bit, with custom vectors last and
+ * in the order they were given.
+ * @param _fields The field names to sort in place
+ */
+inline void sort_fields(std::vector<std::string> &_fields)
+{
+  std::stable_sort(_fields.begin(), _fields.end(),
+                   [](const std::string &_l, const std::string &_r) {
+                     return field_bit(_l) < field_bit(_r);
+                   });
+}
+
 /**
  * @brief Interchange, but for ffield fixes. This may only happen once
  * (upon simulation initialization), or may be reoccurring every once in a while. In
@@ -125,6 +408,56 @@ std::list<FFieldNodeData> ffield_interchange(const double _start[3], const doubl
                                              const unsigned int &_atoms_to_send_size = 0,
                                              const AtomData _atoms_to_send[] = {});
 
+/**
+ * @brief Interchange, but for ffield fixes, sending only the given atom columns along with the
+ * request.
+ * @param _start A 3-tuple (x, y, z) of the lowest corner of the simulation box.
+ * @param _bin_widths A 3-tuple for the x, y, and z spacing of the nodes.
+ * @param _node_counts The number of nodes per side. A 3-tuple of the x, y, and z.
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _every Where to save the "every" keyword (if provided by controller)
+ * @param _atoms_to_send_size The number of atoms in each column. If 0, don't send any atoms.
+ * @param _columns The per-atom data to send to the controller
+ * @returns A std::list of the data to be added
+ */
+std::list<FFieldNodeData> ffield_interchange(const double _start[3], const double _bin_widths[3],
+                                             const unsigned int _node_counts[3],
+                                             const unsigned int &_controller_rank, MPI_Comm &_comm,
+                                             uintmax_t &_every, const size_t &_atoms_to_send_size,
+                                             const std::vector<AtomColumn> &_columns);
+
+/// Defined in grid_codec.h
+struct GridCompression;
+
+/// Defined in interpolation.h
+class NodeGrid;
+
+/**
+ * @brief Interchange, but for ffield fixes, adding the controller's grid straight into the given
+ * nodes. Binary (compressed) grids are only sent if asked for in `_compression`, and are decoded
+ * without an intermediate copy.
+ * @param _start A 3-tuple (x, y, z) of the lowest corner of the simulation box.
+ * @param _bin_widths A 3-tuple for the x, y, and z spacing of the nodes.
+ * @param _node_counts The number of nodes per side. A 3-tuple of the x, y, and z.
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _every Where to save the "every" keyword (if provided by controller)
+ * @param _atoms_to_send_size The number of atoms in each column. If 0, don't send any atoms.
+ * @param _columns The per-atom data to send to the controller
+ * @param _compression The grid compression to ask the controller for
+ * @param _nodes The nodes to add the received force deltas into. Its ghosts are filled in
+ * afterwards.
+ * @param _wait How to wait for the grid
+ * @returns true on success, false on failure
+ */
+bool ffield_interchange(const double _start[3], const double _bin_widths[3],
+                        const unsigned int _node_counts[3], const unsigned int &_controller_rank,
+                        MPI_Comm &_comm, uintmax_t &_every, const size_t &_atoms_to_send_size,
+                        const std::vector<AtomColumn> &_columns,
+                        const GridCompression &_compression, NodeGrid &_nodes,
+                        const WaitMode &_wait = ARBFN_WAIT_SLEEP);
+
 /**
  * @brief Send the given atom data, then receive the given fix data. This is blocking, but does not allow worker-side gridlocks.
  * @param _n The number of atoms/fixes in the arrays.
@@ -138,6 +471,221 @@ std::list<FFieldNodeData> ffield_interchange(const double _start[3], const doubl
 bool interchange(const size_t &_n, const AtomData _from[], FixData _into[], const double &_max_ms,
                  const unsigned int &_controller_rank, MPI_Comm &_comm);
 
+/**
+ * @brief Send the given atom data, then receive the given fix data, using the format which was
+ * negotiated during registration. This is blocking, but does not allow worker-side gridlocks.
+ * @param _n The number of atoms/fixes in the arrays.
+ * @param _from An array of atom data to send
+ * @param _into An array of fix data that was received
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _handshake The result of send_registration
+ * @param _wait How to wait for the response
+ * @returns true on success, false on failure
+ */
+bool interchange(const size_t &_n, const AtomData _from[], FixData _into[], const double &_max_ms,
+                 const unsigned int &_controller_rank, MPI_Comm &_comm,
+                 const Handshake &_handshake, const WaitMode &_wait = ARBFN_WAIT_SLEEP);
+
+/**
+ * @brief Send the given atom columns, then receive the given fix data, using the format which was
+ * negotiated during registration. This is blocking, but does not allow worker-side gridlocks.
+ * @param _n The number of atoms in each column, and of fixes in `_into`.
+ * @param _columns The per-atom data to send, in wire order (see sort_fields)
+ * @param _into An array of fix data that was received
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _handshake The result of send_registration
+ * @param _wait How to wait for the response
+ * @returns true on success, false on failure
+ */
+bool interchange(const size_t &_n, const std::vector<AtomColumn> &_columns, FixData _into[],
+                 const double &_max_ms, const unsigned int &_controller_rank, MPI_Comm &_comm,
+                 const Handshake &_handshake, const WaitMode &_wait = ARBFN_WAIT_SLEEP);
+
+/**
+ * @brief As above, but saves the force deltas in structure-of-arrays order: All n dfx values,
+ * then all n dfy values, then all n dfz values. Binary responses are received straight into
+ * this layout.
+ * @param _n The number of atoms in each column
+ * @param _columns The per-atom data to send, in wire order (see sort_fields)
+ * @param _deltas Where to save the 3n force deltas
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _handshake The result of send_registration
+ * @param _wait How to wait for the response
+ * @returns true on success, false on failure
+ */
+bool interchange(const size_t &_n, const std::vector<AtomColumn> &_columns, double _deltas[],
+                 const double &_max_ms, const unsigned int &_controller_rank, MPI_Comm &_comm,
+                 const Handshake &_handshake, const WaitMode &_wait = ARBFN_WAIT_SLEEP);
+
+/**
+ * @brief Sends the given atom columns and receives their force deltas through collectives over
+ * the whole communicator, as agreed upon during registration (`Handshake::collective`). Every
+ * worker must call this at once, and it cannot time out. The interchange functions call this
+ * themselves when the mode was agreed upon.
+ *
+ * Every rank joins an MPI_Gather of two int64s (the atom count and the field bitmask) to the
+ * controller, then an MPI_Gatherv of its columns as doubles (laid out as the blocks of a binary
+ * request), then an MPI_Scatterv of its deltas (all dfx, then all dfy, then all dfz).
+ * @param _n The number of atoms in each column
+ * @param _columns The per-atom data to send, in wire order (see sort_fields)
+ * @param _deltas Where to save the 3n force deltas
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @returns true on success, false on failure
+ */
+bool collective_interchange(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                            double _deltas[], const unsigned int &_controller_rank,
+                            MPI_Comm &_comm);
+
+/**
+ * @struct PendingRequest
+ * @brief A request which was sent without awaiting its response (see post_request). It owns
+ * everything MPI may still be reading, so it must not be moved or destroyed until it has been
+ * passed to collect_response.
+ */
+struct PendingRequest {
+  /// The number of atoms which were sent
+  size_t n = 0;
+
+  /// A staged copy of the columns which were sent (binary only)
+  std::vector<AtomColumn> columns;
+
+  /// The packet which was sent (JSON only)
+  std::string text;
+
+  /// The header which was sent (binary only)
+  BinaryHeader header;
+
+  /// The send itself
+  MPI_Request request = MPI_REQUEST_NULL;
+
+  /// The new `every` the response asked for, or 0 if none (set by collect_response)
+  uintmax_t every = 0;
+};
+
+/**
+ * @brief Sends the given atom columns without waiting for the send or the response, using the
+ * format which was negotiated during registration. Any column read in place is copied first,
+ * so the caller may change its arrays right away. Requests are answered in the order they are
+ * posted.
+ * @param _n The number of atoms in each column
+ * @param _columns The per-atom data to send, in wire order (see sort_fields)
+ * @param _max_ms The max number of milliseconds the response will be awaited
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _handshake The result of send_registration. Must not be in the collective mode.
+ * @param _into Where to save the request until collect_response
+ */
+void post_request(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                  const double &_max_ms, const unsigned int &_controller_rank, MPI_Comm &_comm,
+                  const Handshake &_handshake, PendingRequest &_into);
+
+/**
+ * @brief Receives the response to the oldest request sent by post_request, saving the force
+ * deltas in structure-of-arrays order (as the `double _deltas[]` interchange does).
+ * @param _request The oldest request which has not yet been collected
+ * @param _deltas Where to save the 3n force deltas
+ * @param _max_ms The max number of milliseconds to await the response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _handshake The result of send_registration
+ * @param _wait How to wait for the response
+ * @returns true on success, false on failure
+ */
+bool collect_response(PendingRequest &_request, double _deltas[], const double &_max_ms,
+                      const unsigned int &_controller_rank, MPI_Comm &_comm,
+                      const Handshake &_handshake, const WaitMode &_wait = ARBFN_WAIT_SLEEP);
+
+/**
+ * @struct TypeScratch
+ * @brief Reusable space to describe a binary request's MPI
+ * datatype in, so that steady-state requests do not allocate
+ */
+struct TypeScratch {
+  /// The length of each block of the datatype
+  std::vector<int> lengths;
+
+  /// The address of each block of the datatype
+  std::vector<MPI_Aint> displacements;
+
+  /// The type of each block of the datatype
+  std::vector<MPI_Datatype> types;
+
+  /// The address of each atom within one column
+  std::vector<MPI_Aint> atoms;
+};
+
+/**
+ * @struct PersistentExchange
+ * @brief A reusable response buffer and persistent receive for steady-state binary interchange
+ * (see persistent_interchange). The buffer holds `capacity` atoms, at least 64 more than each
+ * response should, and is only re-initialized when the number of atoms outgrows it or falls far
+ * below it. Free with free_exchange before MPI_Finalize.
+ */
+struct PersistentExchange {
+  /// The number of atoms the response buffer holds
+  size_t capacity = 0;
+
+  /// The header of the request being sent
+  BinaryHeader header;
+
+  /// Where responses (of up to `capacity` atoms) are received
+  std::vector<char> response;
+
+  /// The send of the current request, straight from its columns
+  MPI_Request send = MPI_REQUEST_NULL;
+
+  /// Where the request's datatype is described
+  TypeScratch scratch;
+
+  /// Persistent receive into `response`
+  MPI_Request receive = MPI_REQUEST_NULL;
+
+  /// The new `every` the last response which set one asked for, or 0 if none has
+  uintmax_t every = 0;
+};
+
+/**
+ * @brief As the structure-of-arrays interchange, but reusing a persistent receive
+ * (MPI_Recv_init) between calls, which is posted before the request is sent. Binary requests
+ * are sent at their exact size through an MPI datatype, without staging the columns.
+ * Responses of the wrong size are reported as malformed, up to the exchange's capacity (a
+ * larger one overflows the buffer, which MPI treats as an error). On failure, the request's send
+ * is freed rather than waited on, so the caller must give up. JSON falls back on plain
+ * interchange.
+ * @param _n The number of atoms in each column
+ * @param _columns The per-atom data to send, in wire order (see sort_fields)
+ * @param _deltas Where to save the 3n force deltas
+ * @param _max_ms The max number of milliseconds to await each response
+ * @param _controller_rank The rank of the controller within the provided communicator
+ * @param _comm The MPI communicator to use
+ * @param _handshake The result of send_registration
+ * @param _exchange The buffers and requests to reuse
+ * @param _wait How to wait for the response
+ * @param _offsets If not empty, the request aggregates several ranks' atoms, and this holds the
+ * index of each rank's first atom. These are sent along for the controller.
+ * @returns true on success, false on failure. A new `every` sent by the controller is saved in
+ * the exchange (not in the collective mode, whose responses cannot carry one).
+ */
+bool persistent_interchange(const size_t &_n, const std::vector<AtomColumn> &_columns,
+                            double _deltas[], const double &_max_ms,
+                            const unsigned int &_controller_rank, MPI_Comm &_comm,
+                            const Handshake &_handshake, PersistentExchange &_exchange,
+                            const WaitMode &_wait = ARBFN_WAIT_SLEEP,
+                            const std::vector<uint64_t> &_offsets = std::vector<uint64_t>());
+
+/**
+ * @brief Frees the persistent requests of an exchange, which must not be in use
+ * @param _exchange The exchange to free
+ */
+void free_exchange(PersistentExchange &_exchange);
+
 /**
  * @brief Sends a registration packet to the controller.
  * @param _controller_rank The rank of the controller instance
@@ -146,6 +694,40 @@ bool interchange(const size_t &_n, const AtomData _from[], FixData _into[], cons
  */
 bool send_registration(unsigned int &_controller_rank, MPI_Comm &_comm);
 
+/**
+ * @brief Sends a registration packet to the controller, offering every wire format this worker
+ * supports. The controller's choice is saved in `_handshake`; JSON is used if it makes none.
+ * @param _controller_rank The rank of the controller instance
+ * @param _comm The communicator to use
+ * @param _handshake Where to save the negotiated settings
+ * @return True on success, false on error.
+ */
+bool send_registration(unsigned int &_controller_rank, MPI_Comm &_comm, Handshake &_handshake);
+
+/**
+ * @brief Like the above, but only registers with the ranks of `_comm` outside `_workers`. These
+ * are found with local group operations, so each worker sends one packet per controller rather
+ * than one per rank, and no stray registrations reach the other workers. If every rank of `_comm`
+ * is in `_workers`, this falls back on registering with every other rank.
+ *
+ * If `_shard` is not negative and there are several ranks outside `_workers`, they must all be
+ * controllers, and the workers are split between them: This worker registers only with the one
+ * `_shard` of the way through them (in rank order), and tells it which shard it is (`"shard"`
+ * and `"shards"`).
+ * @param _controller_rank The rank of the controller instance
+ * @param _comm The communicator to use
+ * @param _handshake Where to save the negotiated settings
+ * @param _workers A communicator holding exactly the workers which are registering (EG `world`)
+ * @param _shard If in [0, 1), where this worker falls among the workers (EG its rank over the
+ * number of workers, or its position along the box), which picks its controller
+ * @param _offer_collective Whether to offer the collective mode. It is only offered if the one
+ * rank outside `_workers` is the controller, so that every other rank is a worker.
+ * @return True on success, false on error.
+ */
+bool send_registration(unsigned int &_controller_rank, MPI_Comm &_comm, Handshake &_handshake,
+                       const MPI_Comm &_workers, const double &_shard = -1.0,
+                       const bool &_offer_collective = false);
+
 /**
  * @brief Sends a deregistration packet to the controller.
  * @param _controller_rank The MPI rank of the controller
@@ -153,4 +735,14 @@ bool send_registration(unsigned int &_controller_rank, MPI_Comm &_comm);
  */
 void send_deregistration(const int &_controller_rank, MPI_Comm &_comm);
 
+/**
+ * @brief Deregisters from the controller. In the collective mode, this must be called by every
+ * worker at once.
+ * @param _controller_rank The MPI rank of the controller
+ * @param _comm The communicator to use
+ * @param _handshake The result of send_registration
+ */
+void send_deregistration(const int &_controller_rank, MPI_Comm &_comm,
+                         const Handshake &_handshake);
+
 #endif
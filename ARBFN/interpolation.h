@@ -9,6 +9,187 @@
 #ifndef ARBFN_INTERPOLATION_HPP
 #define ARBFN_INTERPOLATION_HPP
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/// The SIMD instruction set interpolate_batch was built with, and how many atoms it handles at
+/// once. Splitting a batch only at multiples of the lanes gives exactly the same results.
+#if defined(__AVX512F__)
+#define ARBFN_SIMD_NAME "avx512"
+#define ARBFN_SIMD_LANES 8
+#elif defined(__AVX2__)
+#define ARBFN_SIMD_NAME "avx2"
+#define ARBFN_SIMD_LANES 4
+#else
+#define ARBFN_SIMD_NAME "scalar"
+#define ARBFN_SIMD_LANES 1
+#endif
+
+/**
+ * @class NodeGrid
+ * @brief The (dfx, dfy, dfz) force deltas of every node of an
+ * ffield grid, in one contiguous, cache-line-aligned block. The
+ * grid is padded with one layer of ghost nodes on every side,
+ * extrapolated from the real nodes (see fill_ghosts), so
+ * interpolating next to (or just past) an edge needs no special
+ * cases. Nodes are stored in x-major order (z changes fastest).
+ */
+class NodeGrid {
+ public:
+  NodeGrid() = default;
+  NodeGrid(const NodeGrid &) = delete;
+  NodeGrid &operator=(const NodeGrid &) = delete;
+
+  /**
+   * @brief Makes room for the given number of real nodes, all
+   * zero. Any previous nodes are lost.
+   * @param _counts The number of nodes in x, y and z
+   */
+  void allocate(const unsigned int _counts[3])
+  {
+    shape(_counts);
+
+    // Over-allocated by one cache line, so the first node may start on one
+    const size_t line = 64 / sizeof(double);
+    storage.assign(size() + line, 0.0);
+    const uintptr_t address = (uintptr_t) storage.data();
+    first = storage.data() + ((64 - address % 64) % 64) / sizeof(double);
+  }
+
+  /**
+   * @brief Uses the given block for the nodes instead of its
+   * own, EG memory shared with other ranks. Its contents are
+   * kept. Any previous nodes are lost.
+   * @param _counts The number of nodes in x, y and z
+   * @param _block At least size_for(_counts) doubles, which must
+   * outlive this grid's use of them
+   */
+  void attach(const unsigned int _counts[3], double *const _block)
+  {
+    shape(_counts);
+    storage.clear();
+    storage.shrink_to_fit();
+    first = _block;
+  }
+
+  /// The number of doubles a grid with the given number of real nodes takes, ghosts included
+  static size_t size_for(const unsigned int _counts[3])
+  {
+    return 3 * ((size_t) _counts[0] + 2) * ((size_t) _counts[1] + 2) * ((size_t) _counts[2] + 2);
+  }
+
+  /// Zeroes every node, ghosts included
+  void clear() { std::fill(first, first + size(), 0.0); }
+
+  /// Trades nodes (and shapes) with another grid, without copying them
+  void swap(NodeGrid &_other)
+  {
+    std::swap(counts, _other.counts);
+    std::swap(z_stride, _other.z_stride);
+    std::swap(y_stride, _other.y_stride);
+    storage.swap(_other.storage);
+    std::swap(first, _other.first);
+  }
+
+  /**
+   * @brief Gives the force deltas of a node
+   * @param _x The x index, from -1 (a ghost) to counts[0] (a ghost)
+   * @param _y The y index, likewise
+   * @param _z The z index, likewise
+   * @return The node's (dfx, dfy, dfz)
+   */
+  double *at(const long &_x, const long &_y, const long &_z)
+  {
+    return first + (_x + 1) * y_stride + (_y + 1) * z_stride + 3 * (_z + 1);
+  }
+
+  /// As above
+  const double *at(const long &_x, const long &_y, const long &_z) const
+  {
+    return first + (_x + 1) * y_stride + (_y + 1) * z_stride + 3 * (_z + 1);
+  }
+
+  /// The distance, in doubles, between nodes one apart in y
+  size_t y_step() const { return z_stride; }
+
+  /// The distance, in doubles, between nodes one apart in x
+  size_t x_step() const { return y_stride; }
+
+  /// The number of real nodes in x, y, and z
+  const unsigned int *node_counts() const { return counts; }
+
+  /// The first (ghost) node, at index (-1, -1, -1)
+  const double *data() const { return first; }
+
+  /// The number of doubles from the first node to the end of the last, ghosts included
+  size_t size() const { return y_stride * ((size_t) counts[0] + 2); }
+
+  /**
+   * @brief Fills each ghost by continuing the two nearest real
+   * nodes in a straight line (`2 * edge - next`), so positions
+   * past an edge extrapolate linearly. Must be called whenever
+   * the real nodes change.
+   */
+  void fill_ghosts()
+  {
+    const long nx = counts[0], ny = counts[1], nz = counts[2];
+
+    // One axis at a time, each over the ghosts already filled along the last, so corners follow
+    for (long y = 0; y < ny; ++y) {
+      for (long z = 0; z < nz; ++z) { extend(at(0, y, z), y_stride, nx); }
+    }
+    for (long x = -1; x <= nx; ++x) {
+      for (long z = 0; z < nz; ++z) { extend(at(x, 0, z), z_stride, ny); }
+    }
+    for (long x = -1; x <= nx; ++x) {
+      for (long y = -1; y <= ny; ++y) { extend(at(x, y, 0), 3, nz); }
+    }
+  }
+
+ protected:
+  /// Fills the ghosts at both ends of a line of `_count` nodes, `_step` doubles apart
+  static void extend(double *const _edge, const size_t &_step, const long &_count)
+  {
+    // A single node is all there is, so its ghosts repeat it
+    const size_t next = _count > 1 ? _step : 0;
+    double *const last = _edge + (_count - 1) * _step;
+    for (int k = 0; k < 3; ++k) {
+      _edge[k - (long) _step] = 2.0 * _edge[k] - _edge[next + k];
+      last[k + _step] = 2.0 * last[k] - last[k - (long) next];
+    }
+  }
+
+  /// Takes the given number of real nodes, and the strides that follow from it
+  void shape(const unsigned int _counts[3])
+  {
+    for (int i = 0; i < 3; ++i) { counts[i] = _counts[i]; }
+    z_stride = 3 * ((size_t) counts[2] + 2);
+    y_stride = z_stride * ((size_t) counts[1] + 2);
+  }
+
+  /// The number of real nodes in x, y and z
+  unsigned int counts[3] = {0, 0, 0};
+
+  /// The distances, in doubles, between nodes one apart in y and x
+  size_t z_stride = 0, y_stride = 0;
+
+  /// The nodes, ghosts included, plus room to align them. Empty if attached to another block.
+  std::vector<double> storage;
+
+  /// The first (ghost) node, in `storage` or the attached block
+  double *first = nullptr;
+};
+
 /**
  * @brief Linearly interpolates the 3-tuple of force deltas
  * between 2 points in space (by convention, we call the
@@ -93,53 +274,514 @@ interpolate_box(double _force_deltas[3], const double _pos[3], const double _d_p
 
 /**
  * @brief Given some position, find the proper bin and
- * trilinearly interpolate with the 8 nearest points.
+ * trilinearly interpolate with the 8 nearest points. Positions
+ * outside of the grid extrapolate linearly from its edge bin.
  * @param _force_deltas Where the results are stored
  * @param _pos The GLOBAL position (not relative!)
  * @param _minimal_pos The smallest edge of the simulation box
- * @param _nodes _nodes[x_index][y_index][z_index] is the
- * 3-tuple of force deltas at the given dimensional indices.
+ * @param _nodes The force deltas of the nodes, with their ghosts
+ * filled in
  * @param _position_deltas The "bin widths" between nodes
- * @param _num_nodes The count of nodes on each side
  */
 inline void interpolate(double _force_deltas[3], const double _pos[3], const double _minimal_pos[3],
-                        const double *const *const *const *const _nodes,
-                        const double _position_deltas[3], const unsigned int _num_nodes[3])
+                        const NodeGrid &_nodes, const double _position_deltas[3])
 {
-  // Determine bin ids
-  int x_bin = (int) ((_pos[0] - _minimal_pos[0]) / _position_deltas[0]);
-  int y_bin = (int) ((_pos[1] - _minimal_pos[1]) / _position_deltas[1]);
-  int z_bin = (int) ((_pos[2] - _minimal_pos[2]) / _position_deltas[2]);
+  const unsigned int *const num_nodes = _nodes.node_counts();
+  long bins[3];
+  double local_position[3];
 
-  // Handle edge cases to avoid segfaults
-  if (x_bin < 0) {
-    x_bin = 0;
-  } else if (x_bin + 1 >= _num_nodes[0]) {
-    x_bin = _num_nodes[0] - 2;
+  for (int i = 0; i < 3; ++i) {
+    // Anything past an edge falls into the ghost layer, which continues the edge bin
+    const double bin = std::floor((_pos[i] - _minimal_pos[i]) / _position_deltas[i]);
+    bins[i] = (long) std::min(std::max(bin, -1.0), (double) num_nodes[i] - 1.0);
+
+    // Localize to bins. Further out, the fraction just runs past 0 or 1.
+    local_position[i] = _pos[i] - (_minimal_pos[i] + bins[i] * _position_deltas[i]);
+  }
+
+  // Interpolate
+  const double *const origin = _nodes.at(bins[0], bins[1], bins[2]);
+  const size_t dx = _nodes.x_step(), dy = _nodes.y_step(), dz = 3;
+  interpolate_box(_force_deltas, local_position, _position_deltas, origin, origin + dx,
+                  origin + dy, origin + dx + dy, origin + dz, origin + dx + dz, origin + dy + dz,
+                  origin + dx + dy + dz);
+}
+
+/**
+ * @enum Interpolation
+ * @brief How `fix arbfn/ffield` interpolates between nodes. All
+ * use the same nodes and reproduce linear fields exactly. Past
+ * the grid's edges, all extrapolate linearly from the edge bins,
+ * so agree there.
+ */
+enum Interpolation {
+  /// Trilinear, from the 8 nearest nodes (see interpolate). Errors shrink with the spacing squared.
+  ARBFN_INTERP_LINEAR = 0,
+
+  /// Tricubic (Catmull-Rom), from the 64 nearest nodes, passing through each. Errors shrink with
+  /// the spacing cubed.
+  ARBFN_INTERP_CUBIC = 1,
+
+  /// Cubic B-spline through every node, from 64 prefiltered coefficients (see
+  /// bspline_coefficients). Errors shrink with the spacing to the fourth away from the edges.
+  ARBFN_INTERP_BSPLINE3 = 2
+};
+
+/**
+ * @brief Parses the name of an Interpolation (EG from a fix keyword)
+ * @param _name "linear", "cubic" or "bspline3"
+ * @param _into Where to save the interpolation
+ * @return True on success, false if the name is unknown
+ */
+inline bool interpolation_from_name(const std::string &_name, Interpolation &_into)
+{
+  const char *const names[] = {"linear", "cubic", "bspline3"};
+  for (int i = 0; i < 3; ++i) {
+    if (_name == names[i]) {
+      _into = (Interpolation) i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Gives the weights a cubic kernel puts on the 4 nodes
+ * around a bin (see cubic_stencil)
+ * @param _weights Where to save the weights of nodes `bin - 1` to
+ * `bin + 2`, which sum to 1
+ * @param _f The position within the bin, from 0 to 1
+ * @param _kernel The cubic kernel (not ARBFN_INTERP_LINEAR)
+ */
+inline void cubic_weights(double _weights[4], const double &_f, const Interpolation &_kernel)
+{
+  const double f = _f, f2 = f * f, f3 = f2 * f;
+  if (_kernel == ARBFN_INTERP_BSPLINE3) {
+    _weights[0] = (1.0 - f) * (1.0 - f) * (1.0 - f) / 6.0;
+    _weights[1] = (3.0 * f3 - 6.0 * f2 + 4.0) / 6.0;
+    _weights[2] = (-3.0 * f3 + 3.0 * f2 + 3.0 * f + 1.0) / 6.0;
+    _weights[3] = f3 / 6.0;
+  } else {
+    _weights[0] = 0.5 * (-f3 + 2.0 * f2 - f);
+    _weights[1] = 0.5 * (3.0 * f3 - 5.0 * f2 + 2.0);
+    _weights[2] = 0.5 * (-3.0 * f3 + 4.0 * f2 + f);
+    _weights[3] = 0.5 * (f3 - f2);
   }
-  if (y_bin < 0) {
-    y_bin = 0;
-  } else if (y_bin + 1 >= _num_nodes[1]) {
-    y_bin = _num_nodes[1] - 2;
+}
+
+/**
+ * @brief Finds the 4 nodes along one axis which a cubic kernel
+ * weighs, and their weights. Past an edge, the nodes continue
+ * in a straight line (EG node -1 is `2 * node 0 - node 1`),
+ * which is folded into the weights of the real nodes, so only
+ * real nodes are ever read. Positions outside of the grid
+ * extrapolate linearly from the edge bin's two nodes, just as
+ * interpolate does.
+ * @param _indices Where to save the 4 node indices
+ * @param _weights Where to save their weights, which sum to 1
+ * @param _pos The GLOBAL position along this axis
+ * @param _minimal_pos The smallest edge of the grid along this axis
+ * @param _position_delta The "bin width" along this axis
+ * @param _count The number of nodes along this axis
+ * @param _kernel The cubic kernel (not ARBFN_INTERP_LINEAR)
+ */
+inline void cubic_stencil(long _indices[4], double _weights[4], const double &_pos,
+                          const double &_minimal_pos, const double &_position_delta,
+                          const unsigned int &_count, const Interpolation &_kernel)
+{
+  // A single node is all there is
+  if (_count < 2) {
+    for (int m = 0; m < 4; ++m) {
+      _indices[m] = 0;
+      _weights[m] = m == 0 ? 1.0 : 0.0;
+    }
+    return;
   }
-  if (z_bin < 0) {
-    z_bin = 0;
-  } else if (z_bin + 1 >= _num_nodes[2]) {
-    z_bin = _num_nodes[2] - 2;
+
+  const double last = _count - 1.0;
+  const double t = (_pos - _minimal_pos) / _position_delta;
+  const long bin = (long) std::min(std::max(std::floor(t), 0.0), last - 1.0);
+  const double f = t - bin;
+
+  // Outside, the weights run on in a straight line through those at the edge bin's two nodes
+  if (f < 0.0 || f > 1.0) {
+    double at_start[4], at_end[4];
+    cubic_weights(at_start, 0.0, _kernel);
+    cubic_weights(at_end, 1.0, _kernel);
+    for (int m = 0; m < 4; ++m) { _weights[m] = (1.0 - f) * at_start[m] + f * at_end[m]; }
+  } else {
+    cubic_weights(_weights, f, _kernel);
   }
 
-  // Localize to bins
-  double local_position[3];
-  local_position[0] = _pos[0] - (_minimal_pos[0] + x_bin * _position_deltas[0]);
-  local_position[1] = _pos[1] - (_minimal_pos[1] + y_bin * _position_deltas[1]);
-  local_position[2] = _pos[2] - (_minimal_pos[2] + z_bin * _position_deltas[2]);
+  // Nodes past the edges are extrapolated from the 2 nearest real ones
+  for (int m = 0; m < 4; ++m) { _indices[m] = bin - 1 + m; }
+  if (_indices[0] < 0) {
+    _weights[1] += 2.0 * _weights[0];
+    _weights[2] -= _weights[0];
+    _indices[0] = 0;
+    _weights[0] = 0.0;
+  }
+  if (_indices[3] > (long) _count - 1) {
+    _weights[2] += 2.0 * _weights[3];
+    _weights[1] -= _weights[3];
+    _indices[3] = _count - 1;
+    _weights[3] = 0.0;
+  }
+}
 
-  // Interpolate
-  interpolate_box(_force_deltas, local_position, _position_deltas, _nodes[x_bin][y_bin][z_bin],
-                  _nodes[x_bin + 1][y_bin][z_bin], _nodes[x_bin][y_bin + 1][z_bin],
-                  _nodes[x_bin + 1][y_bin + 1][z_bin], _nodes[x_bin][y_bin][z_bin + 1],
-                  _nodes[x_bin + 1][y_bin][z_bin + 1], _nodes[x_bin][y_bin + 1][z_bin + 1],
-                  _nodes[x_bin + 1][y_bin + 1][z_bin + 1]);
+/**
+ * @brief Given some position, interpolates with a cubic kernel
+ * between the 64 nearest nodes (see cubic_stencil). Positions
+ * outside of the grid extrapolate linearly, as in interpolate.
+ * @param _force_deltas Where the results are stored
+ * @param _pos The GLOBAL position (not relative!)
+ * @param _minimal_pos The smallest edge of the simulation box
+ * @param _nodes The nodes for ARBFN_INTERP_CUBIC, or their
+ * bspline_coefficients for ARBFN_INTERP_BSPLINE3. Ghosts are not
+ * used.
+ * @param _position_deltas The "bin widths" between nodes
+ * @param _kernel The cubic kernel (not ARBFN_INTERP_LINEAR)
+ */
+inline void interpolate_cubic(double _force_deltas[3], const double _pos[3],
+                              const double _minimal_pos[3], const NodeGrid &_nodes,
+                              const double _position_deltas[3], const Interpolation &_kernel)
+{
+  long indices[3][4];
+  double weights[3][4];
+  for (int i = 0; i < 3; ++i) {
+    cubic_stencil(indices[i], weights[i], _pos[i], _minimal_pos[i], _position_deltas[i],
+                  _nodes.node_counts()[i], _kernel);
+  }
+
+  double sum[3] = {0.0, 0.0, 0.0};
+  for (int a = 0; a < 4; ++a) {
+    for (int b = 0; b < 4; ++b) {
+      const double wxy = weights[0][a] * weights[1][b];
+      const double *const row = _nodes.at(indices[0][a], indices[1][b], 0);
+      for (int c = 0; c < 4; ++c) {
+        const double w = wxy * weights[2][c];
+        const double *const node = row + 3 * indices[2][c];
+        sum[0] += w * node[0];
+        sum[1] += w * node[1];
+        sum[2] += w * node[2];
+      }
+    }
+  }
+  std::copy(sum, sum + 3, _force_deltas);
+}
+
+/**
+ * @brief Finds the cubic B-spline coefficients which make a
+ * B-spline pass through every node, so that ARBFN_INTERP_BSPLINE3
+ * reproduces the nodes rather than smoothing them. Past the
+ * edges, the coefficients continue in a straight line (a
+ * "natural" spline), as in cubic_stencil. Each axis is solved in
+ * turn with the Thomas algorithm.
+ * @param _into Where to save the coefficients, one per node. It
+ * is reallocated if its size differs. Its ghosts are not used.
+ * @param _nodes The nodes to pass through
+ */
+inline void bspline_coefficients(NodeGrid &_into, const NodeGrid &_nodes)
+{
+  const unsigned int *const counts = _nodes.node_counts();
+  if (!std::equal(counts, counts + 3, _into.node_counts())) { _into.allocate(counts); }
+  std::copy(_nodes.data(), _nodes.data() + _nodes.size(), _into.at(-1, -1, -1));
+
+  const long strides[3] = {(long) _nodes.x_step(), (long) _nodes.y_step(), 3};
+  std::vector<double> scratch;
+  for (int axis = 0; axis < 3; ++axis) {
+    // The end coefficients equal the end nodes; between them, (c[i-1] + 4c[i] + c[i+1]) / 6
+    // must equal node i
+    const long n = counts[axis];
+    if (n < 3) { continue; }
+    scratch.resize(n);
+
+    const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+    for (long p = 0; p < (long) counts[u]; ++p) {
+      for (long q = 0; q < (long) counts[v]; ++q) {
+        long at[3];
+        at[axis] = 0, at[u] = p, at[v] = q;
+        double *const line = _into.at(at[0], at[1], at[2]);
+        const long stride = strides[axis];
+
+        for (int k = 0; k < 3; ++k) {
+          double *const c = line + k;
+          c[stride] -= c[0] / 6.0;
+          c[(n - 2) * stride] -= c[(n - 1) * stride] / 6.0;
+
+          // Forward sweep over the interior, then back substitution
+          scratch[1] = 4.0 / 6.0;
+          for (long i = 2; i < n - 1; ++i) {
+            const double ratio = (1.0 / 6.0) / scratch[i - 1];
+            scratch[i] = 4.0 / 6.0 - ratio / 6.0;
+            c[i * stride] -= ratio * c[(i - 1) * stride];
+          }
+          c[(n - 2) * stride] /= scratch[n - 2];
+          for (long i = n - 3; i >= 1; --i) {
+            c[i * stride] = (c[i * stride] - c[(i + 1) * stride] / 6.0) / scratch[i];
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ * @brief Finds the nodes needed to interpolate anywhere within
+ * a subdomain, or up to `_ghosts` bins past any side of it.
+ * Nodes past the edges of the grid are never included: There,
+ * interpolate extrapolates just as it would on the whole grid.
+ * @param _first Where to save the index of the first node needed
+ * in x, y and z
+ * @param _counts Where to save the number of nodes needed in x,
+ * y and z
+ * @param _sublo The lowest corner of the subdomain
+ * @param _subhi The highest corner of the subdomain
+ * @param _minimal_pos The smallest edge of the simulation box
+ * @param _position_deltas The "bin widths" between nodes
+ * @param _node_counts The number of nodes in the whole grid
+ * @param _ghosts The number of extra bins to include past each
+ * side, in x, y and z
+ */
+inline void subdomain_nodes(unsigned int _first[3], unsigned int _counts[3],
+                            const double _sublo[3], const double _subhi[3],
+                            const double _minimal_pos[3], const double _position_deltas[3],
+                            const unsigned int _node_counts[3], const double _ghosts[3])
+{
+  for (int i = 0; i < 3; ++i) {
+    const double last_node = _node_counts[i] - 1.0;
+    const double low = std::floor((_sublo[i] - _minimal_pos[i]) / _position_deltas[i]);
+    const double high = std::floor((_subhi[i] - _minimal_pos[i]) / _position_deltas[i]) + 1.0;
+    _first[i] = (unsigned int) std::min(std::max(low - _ghosts[i], 0.0), last_node);
+    _counts[i] =
+        (unsigned int) std::min(std::max(high + _ghosts[i], 0.0), last_node) - _first[i] + 1;
+  }
+}
+
+/**
+ * @brief Copies every node two grids of the same spacing share
+ * from one to the other, then refills the ghosts of the latter.
+ * EG when a rank's nodes move, this keeps whatever was added into
+ * the old ones.
+ * @param _to The grid to copy into
+ * @param _to_first The global index of its first node in x, y and
+ * z
+ * @param _from The grid to copy from
+ * @param _from_first The global index of its first node in x, y
+ * and z
+ * @return The number of nodes copied
+ */
+inline size_t copy_overlap(NodeGrid &_to, const unsigned int _to_first[3], const NodeGrid &_from,
+                           const unsigned int _from_first[3])
+{
+  long lo[3], hi[3];
+  for (int i = 0; i < 3; ++i) {
+    lo[i] = std::max(_to_first[i], _from_first[i]);
+    hi[i] = std::min(_to_first[i] + _to.node_counts()[i], _from_first[i] + _from.node_counts()[i]);
+    if (lo[i] >= hi[i]) { return 0; }
+  }
+
+  // Rows along z are contiguous in both
+  const size_t row = 3 * (hi[2] - lo[2]);
+  for (long x = lo[0]; x < hi[0]; ++x) {
+    for (long y = lo[1]; y < hi[1]; ++y) {
+      const double *const from =
+          _from.at(x - _from_first[0], y - _from_first[1], lo[2] - _from_first[2]);
+      std::copy(from, from + row, _to.at(x - _to_first[0], y - _to_first[1], lo[2] - _to_first[2]));
+    }
+  }
+  _to.fill_ghosts();
+  return (size_t) (hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]);
+}
+
+#if defined(__AVX512F__)
+// GCC's AVX-512 intrinsics start from deliberately undefined registers, which it then warns about
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+/**
+ * @brief Interpolates for 8 atoms at once, as interpolate does
+ * for one (see interpolate_batch)
+ * @param _rows The index of each atom's x in `_positions`
+ * @param _positions The (x, y, z) of every atom
+ * @param _force_deltas Where to save the 8 atoms' (dfx, dfy, dfz)
+ * @param _minimal_pos The smallest edge of the simulation box
+ * @param _nodes The force deltas of the nodes, with their ghosts
+ * filled in
+ * @param _position_deltas The "bin widths" between nodes
+ */
+inline void interpolate_lanes(const __m256i &_rows, const double *const _positions,
+                              double _force_deltas[24], const double _minimal_pos[3],
+                              const NodeGrid &_nodes, const double _position_deltas[3])
+{
+  const size_t steps[3] = {_nodes.x_step(), _nodes.y_step(), 3};
+  const __m512d one = _mm512_set1_pd(1.0);
+  __m512d frac[3];
+  __m256i offsets = _mm256_setzero_si256();
+
+  for (int i = 0; i < 3; ++i) {
+    const __m512d low = _mm512_set1_pd(_minimal_pos[i]);
+    const __m512d width = _mm512_set1_pd(_position_deltas[i]);
+    const __m512d pos = _mm512_i32gather_pd(_rows, _positions + i, 8);
+
+    // Anything past an edge falls into the ghost layer, as in interpolate
+    __m512d bin = _mm512_roundscale_pd(_mm512_div_pd(_mm512_sub_pd(pos, low), width),
+                                       _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    bin = _mm512_min_pd(_mm512_max_pd(bin, _mm512_set1_pd(-1.0)),
+                        _mm512_set1_pd(_nodes.node_counts()[i] - 1.0));
+    const __m512d local = _mm512_sub_pd(pos, _mm512_add_pd(low, _mm512_mul_pd(bin, width)));
+    frac[i] = _mm512_div_pd(local, width);
+
+    // The ghost layer puts bin -1 at index 0
+    const __m256i index = _mm512_cvttpd_epi32(_mm512_add_pd(bin, one));
+    offsets = _mm256_add_epi32(offsets, _mm256_mullo_epi32(index, _mm256_set1_epi32(steps[i])));
+  }
+
+  const auto line = [&one](const __m512d &_a, const __m512d &_b, const __m512d &_frac) {
+    return _mm512_add_pd(_mm512_mul_pd(_a, _mm512_sub_pd(one, _frac)), _mm512_mul_pd(_b, _frac));
+  };
+
+  const double *const first = _nodes.data();
+  const size_t dx = steps[0], dy = steps[1], dz = steps[2];
+  alignas(64) double out[8];
+  for (int k = 0; k < 3; ++k) {
+    const double *const base = first + k;
+    const auto corner = [&](const size_t &_offset) {
+      return _mm512_i32gather_pd(offsets, base + _offset, 8);
+    };
+    const __m512d z0 = line(line(corner(0), corner(dx), frac[0]),
+                            line(corner(dy), corner(dx + dy), frac[0]), frac[1]);
+    const __m512d z1 = line(line(corner(dz), corner(dx + dz), frac[0]),
+                            line(corner(dy + dz), corner(dx + dy + dz), frac[0]), frac[1]);
+    _mm512_store_pd(out, line(z0, z1, frac[2]));
+    for (int lane = 0; lane < 8; ++lane) { _force_deltas[3 * lane + k] = out[lane]; }
+  }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#elif defined(__AVX2__)
+/**
+ * @brief Interpolates for 4 atoms at once, as interpolate does
+ * for one (see interpolate_batch)
+ * @param _rows The index of each atom's x in `_positions`
+ * @param _positions The (x, y, z) of every atom
+ * @param _force_deltas Where to save the 4 atoms' (dfx, dfy, dfz)
+ * @param _minimal_pos The smallest edge of the simulation box
+ * @param _nodes The force deltas of the nodes, with their ghosts
+ * filled in
+ * @param _position_deltas The "bin widths" between nodes
+ */
+inline void interpolate_lanes(const __m128i &_rows, const double *const _positions,
+                              double _force_deltas[12], const double _minimal_pos[3],
+                              const NodeGrid &_nodes, const double _position_deltas[3])
+{
+  const size_t steps[3] = {_nodes.x_step(), _nodes.y_step(), 3};
+  const __m256d one = _mm256_set1_pd(1.0);
+  __m256d frac[3];
+  __m128i offsets = _mm_setzero_si128();
+
+  for (int i = 0; i < 3; ++i) {
+    const __m256d low = _mm256_set1_pd(_minimal_pos[i]);
+    const __m256d width = _mm256_set1_pd(_position_deltas[i]);
+    const __m256d pos = _mm256_i32gather_pd(_positions + i, _rows, 8);
+
+    // Anything past an edge falls into the ghost layer, as in interpolate
+    __m256d bin = _mm256_floor_pd(_mm256_div_pd(_mm256_sub_pd(pos, low), width));
+    bin = _mm256_min_pd(_mm256_max_pd(bin, _mm256_set1_pd(-1.0)),
+                        _mm256_set1_pd(_nodes.node_counts()[i] - 1.0));
+    const __m256d local = _mm256_sub_pd(pos, _mm256_add_pd(low, _mm256_mul_pd(bin, width)));
+    frac[i] = _mm256_div_pd(local, width);
+
+    // The ghost layer puts bin -1 at index 0
+    const __m128i index = _mm256_cvttpd_epi32(_mm256_add_pd(bin, one));
+    offsets = _mm_add_epi32(offsets, _mm_mullo_epi32(index, _mm_set1_epi32(steps[i])));
+  }
+
+  const auto line = [&one](const __m256d &_a, const __m256d &_b, const __m256d &_frac) {
+    return _mm256_add_pd(_mm256_mul_pd(_a, _mm256_sub_pd(one, _frac)), _mm256_mul_pd(_b, _frac));
+  };
+
+  const double *const first = _nodes.data();
+  const size_t dx = steps[0], dy = steps[1], dz = steps[2];
+  alignas(32) double out[4];
+  for (int k = 0; k < 3; ++k) {
+    const double *const base = first + k;
+    const auto corner = [&](const size_t &_offset) {
+      return _mm256_i32gather_pd(base + _offset, offsets, 8);
+    };
+    const __m256d z0 = line(line(corner(0), corner(dx), frac[0]),
+                            line(corner(dy), corner(dx + dy), frac[0]), frac[1]);
+    const __m256d z1 = line(line(corner(dz), corner(dx + dz), frac[0]),
+                            line(corner(dy + dz), corner(dx + dy + dz), frac[0]), frac[1]);
+    _mm256_store_pd(out, line(z0, z1, frac[2]));
+    for (int lane = 0; lane < 4; ++lane) { _force_deltas[3 * lane + k] = out[lane]; }
+  }
+}
+#endif
+
+/**
+ * @brief Interpolates the force deltas of many atoms at once.
+ * Built with AVX-512 or AVX2 enabled (EG `-march=native`), bin
+ * indices and weights are computed for 8 or 4 atoms at a time
+ * in SIMD lanes and the corners are gathered; otherwise, or for
+ * grids too large for 32-bit offsets, this loops over
+ * interpolate. See ARBFN_SIMD_NAME.
+ * @param _n The number of atoms
+ * @param _positions The (x, y, z) of every atom, one after
+ * another (EG `atom->x[0]`)
+ * @param _indices If not null, the index in `_positions` of each
+ * atom to interpolate for. Otherwise, the first `_n` are used.
+ * @param _force_deltas Where to save the (dfx, dfy, dfz) of each
+ * of the `_n` atoms, one after another
+ * @param _minimal_pos The smallest edge of the simulation box
+ * @param _nodes The force deltas of the nodes, with their ghosts
+ * filled in
+ * @param _position_deltas The "bin widths" between nodes
+ */
+inline void interpolate_batch(const size_t &_n, const double *const _positions,
+                              const int *const _indices, double _force_deltas[],
+                              const double _minimal_pos[3], const NodeGrid &_nodes,
+                              const double _position_deltas[3])
+{
+  size_t j = 0;
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+  // Gathers take 32-bit offsets
+  const bool fits = _nodes.size() <= (size_t) INT_MAX;
+
+#if defined(__AVX512F__)
+  const size_t lanes = ARBFN_SIMD_LANES;
+  for (; fits && j + lanes <= _n; j += lanes) {
+    const __m256i atoms = _indices != nullptr
+        ? _mm256_loadu_si256((const __m256i *) (_indices + j))
+        : _mm256_add_epi32(_mm256_set1_epi32(j), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i rows = _mm256_mullo_epi32(atoms, _mm256_set1_epi32(3));
+    interpolate_lanes(rows, _positions, _force_deltas + 3 * j, _minimal_pos, _nodes,
+                      _position_deltas);
+  }
+#else
+  const size_t lanes = ARBFN_SIMD_LANES;
+  for (; fits && j + lanes <= _n; j += lanes) {
+    const __m128i atoms = _indices != nullptr
+        ? _mm_loadu_si128((const __m128i *) (_indices + j))
+        : _mm_add_epi32(_mm_set1_epi32(j), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i rows = _mm_mullo_epi32(atoms, _mm_set1_epi32(3));
+    interpolate_lanes(rows, _positions, _force_deltas + 3 * j, _minimal_pos, _nodes,
+                      _position_deltas);
+  }
+#endif
+#endif
+
+  // The remainder, one at a time
+  for (; j < _n; ++j) {
+    const size_t i = _indices != nullptr ? (size_t) _indices[j] : j;
+    interpolate(_force_deltas + 3 * j, _positions + 3 * i, _minimal_pos, _nodes,
+                _position_deltas);
+  }
 }
 
 #endif
@@ -0,0 +1,156 @@
+/**
+ * @file ARBFN/interpolation_kokkos.h
+ * @brief Provides the Kokkos version of the interpolation in
+ * interpolation.h, for `fix arbfn/ffield/kk`. Only needs Kokkos,
+ * so it can be tested without LAMMPS.
+ * @author J Dehmel, 2025. Written under MIT license.
+ */
+
+#ifndef ARBFN_INTERPOLATION_KOKKOS_HPP
+#define ARBFN_INTERPOLATION_KOKKOS_HPP
+
+#include "interpolation.h"
+#include <Kokkos_Core.hpp>
+
+/**
+ * @class FFieldInterpolator
+ * @brief Adds the interpolated force deltas to the force of
+ * atom `i`, if it is in the group, when run by
+ * `Kokkos::parallel_for`. The math and its order are the same
+ * as interpolate's, so the results match it.
+ * @tparam Positions A view of the (x, y, z) of every atom
+ * @tparam Forces A view of the (fx, fy, fz) of every atom
+ * @tparam Mask A view of the group bits of every atom
+ * @tparam Nodes A flat view of the nodes, laid out as in a
+ * NodeGrid (ghosts included), starting at its data()
+ */
+template <class Positions, class Forces, class Mask, class Nodes> struct FFieldInterpolator {
+  Positions x;
+  Forces f;
+  Mask mask;
+  Nodes nodes;
+
+  /// Only atoms with this bit in their mask are changed
+  int groupbit = 0;
+
+  /// The smallest edge of the simulation box
+  double low[3] = {0.0, 0.0, 0.0};
+
+  /// The "bin widths" between nodes
+  double width[3] = {1.0, 1.0, 1.0};
+
+  /// The highest bin in x/y/z: One less than the number of nodes
+  double last_bin[3] = {0.0, 0.0, 0.0};
+
+  /// The distances, in doubles, between nodes one apart in x/y/z
+  long steps[3] = {0, 0, 3};
+
+  /**
+   * @brief Takes the bins, widths and strides of a grid. The
+   * views must be set separately.
+   * @param _groupbit Only atoms with this bit are changed
+   * @param _minimal_pos The smallest edge of the simulation box
+   * @param _position_deltas The "bin widths" between nodes
+   * @param _nodes The grid `nodes` is a copy of
+   */
+  void describe(const int &_groupbit, const double _minimal_pos[3],
+                const double _position_deltas[3], const NodeGrid &_nodes)
+  {
+    groupbit = _groupbit;
+    for (int i = 0; i < 3; ++i) {
+      low[i] = _minimal_pos[i];
+      width[i] = _position_deltas[i];
+      last_bin[i] = _nodes.node_counts()[i] - 1.0;
+    }
+    steps[0] = _nodes.x_step();
+    steps[1] = _nodes.y_step();
+  }
+
+  /// Interpolates for atom `_i` and adds the result to its force
+  KOKKOS_INLINE_FUNCTION
+  void operator()(const int &_i) const
+  {
+    if (!(mask(_i) & groupbit)) { return; }
+
+    double frac[3];
+    long offset = 0;
+    for (int k = 0; k < 3; ++k) {
+      // Anything past an edge falls into the ghost layer, as in interpolate
+      double bin = Kokkos::floor((x(_i, k) - low[k]) / width[k]);
+      bin = Kokkos::fmin(Kokkos::fmax(bin, -1.0), last_bin[k]);
+      frac[k] = (x(_i, k) - (low[k] + bin * width[k])) / width[k];
+
+      // The ghost layer puts bin -1 at index 0
+      offset += (long) (bin + 1.0) * steps[k];
+    }
+
+    const long dx = steps[0], dy = steps[1], dz = steps[2];
+    for (int k = 0; k < 3; ++k) {
+      const long at = offset + k;
+      const double y0_z0 = nodes(at) * (1.0 - frac[0]) + nodes(at + dx) * frac[0];
+      const double y1_z0 = nodes(at + dy) * (1.0 - frac[0]) + nodes(at + dx + dy) * frac[0];
+      const double y0_z1 = nodes(at + dz) * (1.0 - frac[0]) + nodes(at + dx + dz) * frac[0];
+      const double y1_z1 =
+          nodes(at + dy + dz) * (1.0 - frac[0]) + nodes(at + dx + dy + dz) * frac[0];
+
+      const double z0 = y0_z0 * (1.0 - frac[1]) + y1_z0 * frac[1];
+      const double z1 = y0_z1 * (1.0 - frac[1]) + y1_z1 * frac[1];
+      f(_i, k) += z0 * (1.0 - frac[2]) + z1 * frac[2];
+    }
+  }
+};
+
+/**
+ * @class GroupExtent
+ * @brief Finds the lowest and highest corner of the atoms in a
+ * group when run by `Kokkos::parallel_reduce`, so that their
+ * grid can be checked against it on the device.
+ * @tparam Positions A view of the (x, y, z) of every atom
+ * @tparam Mask A view of the group bits of every atom
+ */
+template <class Positions, class Mask> struct GroupExtent {
+  /// The lowest (x, y, z) of the group, then the highest
+  struct Bounds {
+    double lo[3], hi[3];
+  };
+  typedef Bounds value_type;
+
+  Positions x;
+  Mask mask;
+
+  /// Only atoms with this bit in their mask are counted
+  int groupbit = 0;
+
+  /// Starts from an empty extent
+  KOKKOS_INLINE_FUNCTION
+  void init(value_type &_into) const
+  {
+    for (int k = 0; k < 3; ++k) {
+      _into.lo[k] = HUGE_VAL;
+      _into.hi[k] = -HUGE_VAL;
+    }
+  }
+
+  /// Merges two threads' extents
+  KOKKOS_INLINE_FUNCTION
+  void join(value_type &_into, const value_type &_from) const
+  {
+    for (int k = 0; k < 3; ++k) {
+      _into.lo[k] = Kokkos::fmin(_into.lo[k], _from.lo[k]);
+      _into.hi[k] = Kokkos::fmax(_into.hi[k], _from.hi[k]);
+    }
+  }
+
+  /// Widens the extent to atom `_i`, if it is in the group
+  KOKKOS_INLINE_FUNCTION
+  void operator()(const int &_i, value_type &_into) const
+  {
+    if (!(mask(_i) & groupbit)) { return; }
+    for (int k = 0; k < 3; ++k) {
+      _into.lo[k] = Kokkos::fmin(_into.lo[k], x(_i, k));
+      _into.hi[k] = Kokkos::fmax(_into.hi[k], x(_i, k));
+    }
+  }
+};
+
+#endif
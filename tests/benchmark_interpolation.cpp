@@ -0,0 +1,95 @@
+/*
+Measures how many atoms per second `fix arbfn/ffield`'s
+interpolation handles, one at a time through `interpolate` and
+all at once through `interpolate_batch`, and how much the cubic
+kernels (`interp cubic|bspline3`) cost on top of that. Build with
+`make bench EXTRA=-march=native` to benchmark the SIMD kernel
+this machine supports.
+*/
+
+#include "../ARBFN/interpolation.h"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+const static unsigned int node_counts[3] = {65, 65, 65};
+const static double start[3] = {0.0, 0.0, 0.0};
+const static double spacing[3] = {0.5, 0.5, 0.5};
+const static size_t num_atoms = 1 << 20;
+const static int repeats = 10;
+
+/**
+ * @brief Times the given interpolation over every atom
+ * @param _name What to call it in the output
+ * @param _run Interpolates every atom once
+ */
+template <class F> void bench(const std::string &_name, const F &_run)
+{
+  _run();
+  const auto begin = std::chrono::high_resolution_clock::now();
+  for (int r = 0; r < repeats; ++r) { _run(); }
+  const auto end = std::chrono::high_resolution_clock::now();
+
+  const double seconds = std::chrono::duration<double>(end - begin).count();
+  std::cout << _name << ": " << repeats * num_atoms / seconds << " atoms/sec\n";
+}
+
+int main()
+{
+  NodeGrid grid;
+  grid.allocate(node_counts);
+  for (unsigned int x = 0; x < node_counts[0]; ++x) {
+    for (unsigned int y = 0; y < node_counts[1]; ++y) {
+      for (unsigned int z = 0; z < node_counts[2]; ++z) {
+        double *const node = grid.at(x, y, z);
+        node[0] = sin(0.1 * x);
+        node[1] = cos(0.2 * y);
+        node[2] = 0.01 * z;
+      }
+    }
+  }
+  grid.fill_ghosts();
+
+  // Atoms scattered all over the box, as after a few reneighbors
+  std::mt19937 rng(1234);
+  std::vector<double> positions(3 * num_atoms), deltas(3 * num_atoms);
+  for (size_t i = 0; i < positions.size(); ++i) {
+    std::uniform_real_distribution<double> dist(0.0, (node_counts[i % 3] - 1) * spacing[i % 3]);
+    positions[i] = dist(rng);
+  }
+
+  double checksum = 0.0;
+  bench("scalar", [&]() {
+    for (size_t i = 0; i < num_atoms; ++i) {
+      interpolate(deltas.data() + 3 * i, positions.data() + 3 * i, start, grid, spacing);
+    }
+    checksum += deltas[0];
+  });
+  bench(std::string("batched (") + ARBFN_SIMD_NAME + ")", [&]() {
+    interpolate_batch(num_atoms, positions.data(), nullptr, deltas.data(), start, grid, spacing);
+    checksum += deltas[0];
+  });
+
+  NodeGrid coefficients;
+  bspline_coefficients(coefficients, grid);
+  bench("cubic", [&]() {
+    for (size_t i = 0; i < num_atoms; ++i) {
+      interpolate_cubic(deltas.data() + 3 * i, positions.data() + 3 * i, start, grid, spacing,
+                        ARBFN_INTERP_CUBIC);
+    }
+    checksum += deltas[0];
+  });
+  bench("bspline3", [&]() {
+    for (size_t i = 0; i < num_atoms; ++i) {
+      interpolate_cubic(deltas.data() + 3 * i, positions.data() + 3 * i, start, coefficients,
+                        spacing, ARBFN_INTERP_BSPLINE3);
+    }
+    checksum += deltas[0];
+  });
+
+  // Keeps the loops from being optimized away
+  std::cout << "checksum " << checksum << "\n";
+  return 0;
+}
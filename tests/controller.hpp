@@ -5,15 +5,325 @@
 
 #pragma once
 
+#include "../ARBFN/grid_codec.h"
+#include "../ARBFN/interchange.h"
 #include <boost/json/object.hpp>
 #include <boost/json/src.hpp>
+#include <algorithm>
+#include <cassert>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <mpi.h>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <vector>
+
+/**
+ * @brief Receives the packet described by a previous probe
+ * @param _status The status given by MPI_Probe or MPI_Iprobe
+ * @param _comm The communicator the probe was made on
+ * @return The raw bytes of the packet
+ */
+inline std::vector<char> receive_packet(const MPI_Status &_status, MPI_Comm &_comm)
+{
+  int count = 0;
+  MPI_Get_count(&_status, MPI_BYTE, &count);
+  std::vector<char> buffer(count);
+  MPI_Recv(buffer.data(), count, MPI_BYTE, _status.MPI_SOURCE, _status.MPI_TAG, _comm,
+           MPI_STATUS_IGNORE);
+  return buffer;
+}
+
+/**
+ * @brief Gives the fields of a request's blocks, in wire order
+ * @param _bits The field bitmask of the request
+ * @param _fields The fields this controller asked for. Any other
+ * built-in field in the bits (EG the `tag` sent with a `skin`) is
+ * added.
+ * @return The names of the fields
+ */
+inline std::vector<std::string> request_fields(const uint64_t &_bits,
+                                               const std::vector<std::string> &_fields)
+{
+  std::vector<std::string> fields = _fields;
+  for (const std::string name : {"x", "v", "f", "mu", "type", "tag", "q"}) {
+    const bool asked = std::find(fields.begin(), fields.end(), name) != fields.end();
+    if ((_bits & field_bit(name)) && !asked) { fields.push_back(name); }
+  }
+  sort_fields(fields);
+  return fields;
+}
+
+/**
+ * @brief Decodes a packet of either wire format into JSON. Binary
+ * requests are unpacked into the same "atoms" list that a JSON
+ * request would have, so callbacks need not know which format a
+ * worker chose.
+ * @param _packet The raw bytes of the packet
+ * @param _tag The MPI tag the packet was sent with
+ * @param _fields The fields this controller asked for. If empty,
+ * the blocks are inferred from the header's field bits.
+ * @return The JSON version of the packet
+ */
+inline boost::json::object decode_packet(const std::vector<char> &_packet, const int &_tag,
+                                         const std::vector<std::string> &_fields = {})
+{
+  if (_tag != ARBFN_BINARY_TAG) {
+    return boost::json::parse(boost::json::string_view(_packet.data(), _packet.size()))
+        .as_object();
+  }
+
+  BinaryHeader header;
+  assert(_packet.size() >= sizeof(header));
+  memcpy(&header, _packet.data(), sizeof(header));
+  assert(header.magic == ARBFN_BINARY_MAGIC && header.type == ARBFN_BINARY_REQUEST);
+
+  const std::vector<std::string> fields = request_fields(header.fields, _fields);
+
+  boost::json::array atoms;
+  for (uint64_t i = 0; i < header.count; ++i) { atoms.push_back(boost::json::object()); }
+
+  size_t offset = sizeof(header);
+  for (const auto &name : fields) {
+    const AtomColumn column = make_column(name);
+    assert(header.fields & column.field);
+    assert(_packet.size() >= offset + header.count * column.width * sizeof(double));
+
+    for (uint64_t i = 0; i < header.count; ++i) {
+      boost::json::object &atom = atoms[i].as_object();
+      for (unsigned int k = 0; k < column.width; ++k) {
+        double value;
+        memcpy(&value, _packet.data() + offset, sizeof(value));
+        offset += sizeof(value);
+
+        if (column.is_integer) {
+          atom[column_key(column, k)] = (int64_t) value;
+        } else {
+          atom[column_key(column, k)] = value;
+        }
+      }
+    }
+  }
+
+  boost::json::object json;
+  json["type"] = "request";
+  json["atoms"] = atoms;
+
+  // An aggregated request lists where each rank's atoms start
+  if (header.segments > 0) {
+    assert(_packet.size() >= offset + header.segments * sizeof(uint64_t));
+    boost::json::array offsets;
+    for (uint64_t i = 0; i < header.segments; ++i) {
+      uint64_t value;
+      memcpy(&value, _packet.data() + offset + i * sizeof(value), sizeof(value));
+      offsets.push_back(value);
+    }
+    json["offsets"] = offsets;
+  }
+  return json;
+}
+
+/**
+ * @brief Checks the per-rank offsets of an aggregated request, if
+ * it has any: They must start at zero and never decrease or pass
+ * the end of the atoms
+ * @param _request The decoded request packet
+ */
+inline void check_offsets(const boost::json::object &_request)
+{
+  if (!_request.contains("offsets")) { return; }
+  const auto &offsets = _request.at("offsets").as_array();
+  const int64_t count = _request.at("atoms").as_array().size();
+  int64_t last = 0;
+  assert(!offsets.empty() && offsets[0].to_number<int64_t>() == 0);
+  for (const auto &offset : offsets) {
+    const int64_t at = offset.to_number<int64_t>();
+    assert(at >= last && at <= count);
+    last = at;
+  }
+  (void) count;
+  (void) last;
+}
+
+/**
+ * @brief Notes which shard a sharded worker says this controller
+ * is, checking that all of its workers agree
+ * @param _registration The worker's registration packet
+ * @param _shard This controller's shard, or -1 if not yet known
+ */
+inline void check_shard(const boost::json::object &_registration, int64_t &_shard)
+{
+  if (!_registration.contains("shard")) { return; }
+  const int64_t shard = _registration.at("shard").to_number<int64_t>();
+  if (_shard < 0) {
+    _shard = shard;
+    std::cerr << __FILE__ << ":" << __LINE__ << "> "
+              << "Controller is shard " << shard << " of "
+              << _registration.at("shards").to_number<int64_t>() << "\n"
+              << std::flush;
+  }
+  assert(shard == _shard);
+}
+
+/**
+ * @brief Builds the ack for a registration packet, accepting the
+ * binary wire format iff the worker offered it
+ * @param _registration The worker's registration packet
+ * @param _fields The per-atom fields to ask for. If empty, the
+ * worker sends its defaults.
+ * @param _collective Whether to choose the collective mode, which
+ * the worker must have offered
+ * @return The ack packet to send back
+ */
+inline std::string make_ack(const boost::json::object &_registration,
+                            const std::vector<std::string> &_fields = {},
+                            const bool &_collective = false)
+{
+  boost::json::object ack;
+  ack["type"] = "ack";
+  if (_collective) { ack["collective"] = true; }
+  if (_registration.contains("formats")) {
+    for (const auto &format : _registration.at("formats").as_array()) {
+      if (format == "binary") { ack["format"] = "binary"; }
+    }
+  }
+  if (!_fields.empty()) {
+    boost::json::array fields;
+    for (const auto &field : _fields) { fields.push_back(boost::json::string(field)); }
+    ack["fields"] = fields;
+  }
+
+  std::stringstream s;
+  s << ack;
+  return s.str();
+}
+
+/**
+ * @brief Sends a response packet in the same wire format as the
+ * request it answers
+ * @param _deltas The (dfx, dfy, dfz) triples of every atom
+ * @param _tag The MPI tag of the request
+ * @param _to The rank to send to
+ * @param _comm The communicator to use
+ * @param _every If not zero, the new `every` of the fix
+ */
+inline void send_response(const std::vector<double> &_deltas, const int &_tag, const int &_to,
+                          MPI_Comm &_comm, const uint64_t &_every = 0)
+{
+  if (_tag == ARBFN_BINARY_TAG) {
+    BinaryHeader header;
+    header.magic = ARBFN_BINARY_MAGIC;
+    header.type = ARBFN_BINARY_RESPONSE;
+    header.count = _deltas.size() / 3;
+    header.fields = 0;
+    header.segments = 0;
+    header.every = _every != 0 ? (int64_t) _every : -1;
+
+    std::vector<char> raw(sizeof(header) + _deltas.size() * sizeof(double));
+    memcpy(raw.data(), &header, sizeof(header));
+    memcpy(raw.data() + sizeof(header), _deltas.data(), _deltas.size() * sizeof(double));
+    MPI_Send(raw.data(), raw.size(), MPI_BYTE, _to, ARBFN_BINARY_TAG, _comm);
+    return;
+  }
+
+  boost::json::array list;
+  for (size_t i = 0; i + 2 < _deltas.size(); i += 3) {
+    boost::json::object fix;
+    fix["dfx"] = _deltas[i];
+    fix["dfy"] = _deltas[i + 1];
+    fix["dfz"] = _deltas[i + 2];
+    list.push_back(fix);
+  }
+
+  // Properly format the response
+  boost::json::object json_to_send;
+  json_to_send["type"] = "response";
+  json_to_send["atoms"] = list;
+  if (_every != 0) { json_to_send["every"] = _every; }
+  std::stringstream s;
+  s << json_to_send;
+  const std::string raw = s.str();
+  MPI_Send(raw.c_str(), raw.size(), MPI_CHAR, _to, ARBFN_JSON_TAG, _comm);
+}
+
+/**
+ * @class ResponseSender
+ * @brief Sends responses like send_response, but sends binary
+ * ones through one persistent MPI request per worker. Each is
+ * only re-initialized when that worker's response size changes.
+ */
+class ResponseSender {
+ public:
+  /**
+   * @brief Sends a response packet in the same wire format as
+   * the request it answers
+   * @param _deltas The (dfx, dfy, dfz) triples of every atom
+   * @param _tag The MPI tag of the request
+   * @param _to The rank to send to
+   * @param _comm The communicator to use
+   * @param _every If not zero, the new `every` of the fix
+   */
+  void send(const std::vector<double> &_deltas, const int &_tag, const int &_to,
+            MPI_Comm &_comm, const uint64_t &_every = 0)
+  {
+    if (_tag != ARBFN_BINARY_TAG) {
+      send_response(_deltas, _tag, _to, _comm, _every);
+      return;
+    }
+
+    // The last response must be sent before its buffer is reused
+    Channel &channel = channels[_to];
+    if (channel.request != MPI_REQUEST_NULL) { MPI_Wait(&channel.request, MPI_STATUS_IGNORE); }
+
+    const size_t size = sizeof(BinaryHeader) + _deltas.size() * sizeof(double);
+    if (channel.request == MPI_REQUEST_NULL || channel.buffer.size() != size) {
+      if (channel.request != MPI_REQUEST_NULL) { MPI_Request_free(&channel.request); }
+      channel.buffer.resize(size);
+      MPI_Send_init(channel.buffer.data(), size, MPI_BYTE, _to, ARBFN_BINARY_TAG, _comm,
+                    &channel.request);
+    }
+
+    BinaryHeader header;
+    header.magic = ARBFN_BINARY_MAGIC;
+    header.type = ARBFN_BINARY_RESPONSE;
+    header.count = _deltas.size() / 3;
+    header.fields = 0;
+    header.segments = 0;
+    header.every = _every != 0 ? (int64_t) _every : -1;
+    memcpy(channel.buffer.data(), &header, sizeof(header));
+    memcpy(channel.buffer.data() + sizeof(header), _deltas.data(),
+           _deltas.size() * sizeof(double));
+    MPI_Start(&channel.request);
+  }
+
+  /// Finishes every send and frees the requests
+  void release()
+  {
+    for (auto &p : channels) {
+      if (p.second.request == MPI_REQUEST_NULL) { continue; }
+      MPI_Wait(&p.second.request, MPI_STATUS_IGNORE);
+      MPI_Request_free(&p.second.request);
+    }
+    channels.clear();
+  }
+
+ protected:
+  /// One worker's buffer and persistent send
+  struct Channel {
+    std::vector<char> buffer;
+    MPI_Request request = MPI_REQUEST_NULL;
+  };
+
+  /// Maps worker rank to its channel
+  std::map<int, Channel> channels;
+};
 
 /**
  * @brief A controller wherein every atom's fix is independent
@@ -22,15 +332,22 @@
  * @param _single_atom_lambda The fix to call on every atom,
  * with the atom's data being the JSON first arg and the
  * resultant force deltas being saved in the second-fourth args.
+ * @param _max_ms The max number of ms to go without hearing from any worker
+ * @param _fields The per-atom fields to ask workers for. If empty,
+ * they send their defaults.
+ * @param _every If not zero, every response asks the worker to
+ * only call the controller this often
  */
 inline void independent_controller(
     std::function<void(const boost::json::object &, double &, double &, double &)>
         _single_atom_lambda,
-    const uint64_t &_max_ms = 10000)
+    const uint64_t &_max_ms = 10000, const std::vector<std::string> &_fields = {},
+    const uint64_t &_every = 0)
 {
   MPI_Comm comm, junk_comm;
   MPI_Init(NULL, NULL);
-  MPI_Comm_split(MPI_COMM_WORLD, 0, 0, &junk_comm);
+  // A color of its own keeps the controller out of the workers' comm
+  MPI_Comm_split(MPI_COMM_WORLD, 1, 0, &junk_comm);
   MPI_Comm_split(MPI_COMM_WORLD, 56789, 0, &comm);
 
   std::cerr << __FILE__ << ":" << __LINE__ << "> "
@@ -39,7 +356,12 @@ inline void independent_controller(
 
   // For as long as there are connections left
   uint request_instance_counter = 0, requests = 0;
+  ResponseSender responses;
   uint num_registered = 0;
+  int64_t shard = -1;
+
+  // Don't halt before the first worker has even registered
+  bool any_registered = false;
   uint64_t ms_since_update = 0;
   do {
     MPI_Status status;
@@ -48,16 +370,14 @@ inline void independent_controller(
 
     if (flag) {
       ms_since_update = 0;
-      char *const buffer = new char[status._ucount + 1];
-      MPI_Recv(buffer, status._ucount, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, comm, &status);
-      buffer[status._ucount] = '\0';
-      boost::json::object json = boost::json::parse(buffer).as_object();
-      delete[] buffer;
+      boost::json::object json = decode_packet(receive_packet(status, comm), status.MPI_TAG, _fields);
 
       // Bookkeeping
       if (json["type"] == "register") {
         ++num_registered;
-        const std::string raw = "{\"type\": \"ack\"}";
+        any_registered = true;
+        check_shard(json, shard);
+        const std::string raw = make_ack(json, _fields);
         MPI_Send(raw.c_str(), raw.size(), MPI_CHAR, status.MPI_SOURCE, 0, comm);
       } else if (json["type"] == "deregister") {
         assert(num_registered > 0);
@@ -76,28 +396,20 @@ inline void independent_controller(
         }
 
         // Determine fix to send back
-        boost::json::array list;
+        check_offsets(json);
+        std::vector<double> deltas;
         for (const auto &item : json["atoms"].as_array()) {
           double dfx = 0.0, dfy = 0.0, dfz = 0.0;
 
           // Processing here
           _single_atom_lambda(item.as_object(), dfx, dfy, dfz);
 
-          boost::json::object fix;
-          fix["dfx"] = dfx;
-          fix["dfy"] = dfy;
-          fix["dfz"] = dfz;
-          list.push_back(fix);
+          deltas.push_back(dfx);
+          deltas.push_back(dfy);
+          deltas.push_back(dfz);
         }
 
-        // Properly format the response
-        boost::json::object json_to_send;
-        json_to_send["type"] = "response";
-        json_to_send["atoms"] = list;
-        std::stringstream s;
-        s << json_to_send;
-        const std::string raw = s.str();
-        MPI_Send(s.str().c_str(), raw.size(), MPI_CHAR, status.MPI_SOURCE, 0, comm);
+        responses.send(deltas, status.MPI_TAG, status.MPI_SOURCE, comm, _every);
       }
     } else {
       // Delay
@@ -106,11 +418,12 @@ inline void independent_controller(
 
       if (ms_since_update > _max_ms) { MPI_Abort(comm, 10); }
     }
-  } while (num_registered != 0);
+  } while (!any_registered || num_registered != 0);
 
   std::cerr << __FILE__ << ":" << __LINE__ << "> "
             << "Halting controller\n"
             << std::flush;
+  responses.release();
 
   MPI_Barrier(MPI_COMM_WORLD);
   MPI_Comm_free(&comm);
@@ -118,6 +431,106 @@ inline void independent_controller(
   MPI_Finalize();
 }
 
+/**
+ * @brief Serves bulk requests through collectives over the whole
+ * communicator, as chosen during registration: An MPI_Gather of
+ * each worker's atom count and field bits, an MPI_Gatherv of
+ * their atoms and an MPI_Scatterv of their deltas. Returns once
+ * every worker has deregistered (with a count of -1).
+ * @param _comm The ARBFN communicator, where every other rank is
+ * a worker
+ * @param _on_recv_all As for dependent_controller
+ * @param _single_atom As for dependent_controller
+ * @param _fields The per-atom fields the workers were asked for
+ */
+inline void collective_controller(
+    MPI_Comm &_comm, std::function<bool(const boost::json::array &)> _on_recv_all,
+    std::function<void(const uint64_t &, double &, double &, double &)> _single_atom,
+    const std::vector<std::string> &_fields)
+{
+  int rank, size;
+  MPI_Comm_rank(_comm, &rank);
+  MPI_Comm_size(_comm, &size);
+
+  std::vector<int64_t> headers(2 * size);
+  std::vector<int> counts(size), displs(size);
+  std::vector<double> received, deltas;
+  uint requests = 0;
+
+  while (true) {
+    const int64_t mine[2] = {0, 0};
+    MPI_Gather(mine, 2, MPI_INT64_T, headers.data(), 2, MPI_INT64_T, rank, _comm);
+
+    // Workers deregister all at once
+    uint num_leaving = 0;
+    for (int r = 0; r < size; ++r) {
+      if (r != rank && headers[2 * r] < 0) { ++num_leaving; }
+    }
+    assert(num_leaving == 0 || num_leaving == (uint) size - 1);
+    if (num_leaving > 0) { break; }
+
+    // Each worker sends its columns as the blocks of a binary request
+    int total = 0;
+    for (int r = 0; r < size; ++r) {
+      size_t width = 0;
+      for (const auto &name : request_fields(headers[2 * r + 1], _fields)) {
+        width += make_column(name).width;
+      }
+      counts[r] = r == rank ? 0 : headers[2 * r] * width;
+      displs[r] = total;
+      total += counts[r];
+    }
+    received.resize(total);
+    MPI_Gatherv(nullptr, 0, MPI_DOUBLE, received.data(), counts.data(), displs.data(), MPI_DOUBLE,
+                rank, _comm);
+
+    // Decode them as if they had been sent as packets
+    boost::json::array list;
+    for (int r = 0; r < size; ++r) {
+      if (r == rank) { continue; }
+      BinaryHeader header;
+      header.magic = ARBFN_BINARY_MAGIC;
+      header.type = ARBFN_BINARY_REQUEST;
+      header.count = headers[2 * r];
+      header.fields = headers[2 * r + 1];
+      header.segments = 0;
+      header.every = -1;
+
+      std::vector<char> packet(sizeof(header) + counts[r] * sizeof(double));
+      memcpy(packet.data(), &header, sizeof(header));
+      memcpy(packet.data() + sizeof(header), received.data() + displs[r],
+             counts[r] * sizeof(double));
+      const boost::json::object json = decode_packet(packet, ARBFN_BINARY_TAG, _fields);
+      for (const auto &item : json.at("atoms").as_array()) { list.push_back(item); }
+    }
+
+    if (++requests % 1000 == 0) { std::cerr << "Request #" << requests << "\n" << std::flush; }
+
+    // Nobody is waiting on a packet, so just ask again
+    while (!_on_recv_all(list)) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+
+    // Every worker gets its dfx, then dfy, then dfz
+    total = 0;
+    uint64_t index = 0;
+    for (int r = 0; r < size; ++r) {
+      const int n = r == rank ? 0 : headers[2 * r];
+      counts[r] = 3 * n;
+      displs[r] = total;
+      total += counts[r];
+    }
+    deltas.resize(total);
+    for (int r = 0; r < size; ++r) {
+      const int n = counts[r] / 3;
+      for (int i = 0; i < n; ++i, ++index) {
+        double *const at = deltas.data() + displs[r] + i;
+        _single_atom(index, at[0], at[n], at[2 * n]);
+      }
+    }
+    MPI_Scatterv(deltas.data(), counts.data(), displs.data(), MPI_DOUBLE, nullptr, 0, MPI_DOUBLE,
+                 rank, _comm);
+  }
+}
+
 /**
  * @brief A prebuilt controller wherein no atom's force deltas
  * can be determined before all data has been reported. This is
@@ -132,15 +545,23 @@ inline void independent_controller(
  * @param _single_atom Called for each atom after the other
  * lambda. Provides only an index, so you best hang onto the
  * bulk atom data provided in the previous callback.
+ * @param _max_ms The max number of ms to go without hearing from any worker
+ * @param _fields The per-atom fields to ask workers for. If empty,
+ * they send their defaults.
+ * @param _collective If true, wait for every other rank to
+ * register, then serve them through collectives (see
+ * collective_controller) if they all offered to
  */
 inline void dependent_controller(
     std::function<bool(const boost::json::array &)> _on_recv_all,
     std::function<void(const uint64_t &, double &, double &, double &)> _single_atom,
-    const uint64_t &_max_ms = 10000)
+    const uint64_t &_max_ms = 10000, const std::vector<std::string> &_fields = {},
+    const bool &_collective = false)
 {
   MPI_Comm comm, junk_comm;
   MPI_Init(NULL, NULL);
-  MPI_Comm_split(MPI_COMM_WORLD, 0, 0, &junk_comm);
+  // A color of its own keeps the controller out of the workers' comm
+  MPI_Comm_split(MPI_COMM_WORLD, 1, 0, &junk_comm);
   MPI_Comm_split(MPI_COMM_WORLD, 56789, 0, &comm);
 
   std::cerr << __FILE__ << ":" << __LINE__ << "> "
@@ -149,11 +570,26 @@ inline void dependent_controller(
 
   // For as long as there are connections left
   uint requests = 0;
+  ResponseSender responses;
   uint num_registered = 0;
+  int64_t shard = -1;
+
+  // Don't halt before the first worker has even registered
+  bool any_registered = false;
 
-  // Bulk controlling: Maps worker rank to atom data
-  // Cleared after every successful step
-  std::map<int, boost::json::array> bulk_received;
+  // Bulk controlling: Maps worker rank to atom data, oldest
+  // request first. Workers may send several requests before
+  // reading any response (EG `fix arbfn ... lag 2`)
+  std::map<int, std::deque<boost::json::array>> bulk_received;
+  uint num_ready = 0;
+
+  // Maps worker rank to the MPI tag (wire format) of its requests
+  std::map<int, int> bulk_tags;
+
+  // Maps worker rank to its registration, while awaiting the rest (collective only)
+  std::map<int, boost::json::object> registrations;
+  int comm_size;
+  MPI_Comm_size(comm, &comm_size);
   uint64_t ms_since_update = 0;
 
   do {
@@ -162,16 +598,34 @@ inline void dependent_controller(
     MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &status);
 
     if (flag) {
-      char *const buffer = new char[status._ucount + 1];
-      MPI_Recv(buffer, status._ucount, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, comm, &status);
-      buffer[status._ucount] = '\0';
-      boost::json::object json = boost::json::parse(buffer).as_object();
-      delete[] buffer;
+      ms_since_update = 0;
+      boost::json::object json = decode_packet(receive_packet(status, comm), status.MPI_TAG, _fields);
 
       // Bookkeeping
-      if (json["type"] == "register") {
+      if (json["type"] == "register" && _collective) {
+        // Only answer once it is known whether every worker can join the collectives
+        ++num_registered;
+        any_registered = true;
+        registrations[status.MPI_SOURCE] = json;
+        if (registrations.size() + 1 < (size_t) comm_size) { continue; }
+
+        bool collective = true;
+        for (const auto &p : registrations) {
+          collective = collective && p.second.contains("collective");
+        }
+        for (const auto &p : registrations) {
+          const std::string raw = make_ack(p.second, _fields, collective);
+          MPI_Send(raw.c_str(), raw.size(), MPI_CHAR, p.first, 0, comm);
+        }
+        if (collective) {
+          collective_controller(comm, _on_recv_all, _single_atom, _fields);
+          break;
+        }
+      } else if (json["type"] == "register") {
         ++num_registered;
-        const std::string raw = "{\"type\": \"ack\"}";
+        any_registered = true;
+        check_shard(json, shard);
+        const std::string raw = make_ack(json, _fields);
         MPI_Send(raw.c_str(), raw.size(), MPI_CHAR, status.MPI_SOURCE, 0, comm);
       } else if (json["type"] == "deregister") {
         assert(num_registered > 0);
@@ -181,8 +635,11 @@ inline void dependent_controller(
       // Data processing
       else if (json["type"] == "request") {
         // Synchronization stuff
-        bulk_received[status.MPI_SOURCE] = json.at("atoms").as_array();
-        if (bulk_received.size() != num_registered) {
+        auto &queue = bulk_received[status.MPI_SOURCE];
+        queue.push_back(json.at("atoms").as_array());
+        if (queue.size() == 1) { ++num_ready; }
+        bulk_tags[status.MPI_SOURCE] = status.MPI_TAG;
+        if (num_ready != num_registered) {
           // Send waiting packet and continue
           const std::string msg = "{\"type\": \"waiting\"}";
           MPI_Send(msg.c_str(), msg.size(), MPI_CHAR, status.MPI_SOURCE, 0, comm);
@@ -198,7 +655,7 @@ inline void dependent_controller(
         // Prepare list of all atoms
         boost::json::array list_to_send;
         for (const auto &p : bulk_received) {
-          for (const auto &item : p.second) {
+          for (const auto &item : p.second.front()) {
             // `item` is a single atom
             list_to_send.push_back(item.as_object());
           }
@@ -216,33 +673,33 @@ inline void dependent_controller(
         // Get atom info from second lambda and send to workers
         uint index = 0;
         for (const auto &p : bulk_received) {
-          boost::json::array list;
-          for (const auto &item : p.second) {
+          std::vector<double> deltas;
+          for (size_t i = 0; i < p.second.front().size(); ++i) {
             double dfx = 0.0, dfy = 0.0, dfz = 0.0;
 
             // Processing here
             _single_atom(index, dfx, dfy, dfz);
 
-            boost::json::object fix;
-            fix["dfx"] = dfx;
-            fix["dfy"] = dfy;
-            fix["dfz"] = dfz;
-            list.push_back(fix);
+            deltas.push_back(dfx);
+            deltas.push_back(dfy);
+            deltas.push_back(dfz);
 
             ++index;
           }
 
-          // Properly format the response
-          boost::json::object json_to_send;
-          json_to_send["type"] = "response";
-          json_to_send["atoms"] = list;
-          std::stringstream s;
-          s << json_to_send;
-          const std::string raw = s.str();
-          MPI_Send(s.str().c_str(), raw.size(), MPI_CHAR, status.MPI_SOURCE, 0, comm);
+          responses.send(deltas, bulk_tags[p.first], p.first, comm);
         }
 
-        bulk_received.clear();
+        // Each worker's oldest request has been answered
+        num_ready = 0;
+        for (auto it = bulk_received.begin(); it != bulk_received.end();) {
+          it->second.pop_front();
+          if (it->second.empty()) {
+            it = bulk_received.erase(it);
+          } else {
+            ++num_ready, ++it;
+          }
+        }
       }
     } else {
       // Delay
@@ -251,11 +708,12 @@ inline void dependent_controller(
 
       if (ms_since_update > _max_ms) { MPI_Abort(comm, 10); }
     }
-  } while (num_registered != 0);
+  } while (!any_registered || num_registered != 0);
 
   std::cerr << __FILE__ << ":" << __LINE__ << "> "
             << "Halting controller\n"
             << std::flush;
+  responses.release();
 
   MPI_Barrier(MPI_COMM_WORLD);
   MPI_Comm_free(&comm);
@@ -267,31 +725,27 @@ inline void dependent_controller(
  * @brief ffield controller for more efficient special cases
  * @param _get_forces Maps array of atoms, flag indicating first
  * node, and position to forces (last argument).
+ * @param _fields The per-atom fields to ask workers for. If empty,
+ * they send their defaults.
  */
 inline void ffield_controller(
     std::function<void(const boost::json::value &, const bool &, const double[3], double[3])>
-        _get_forces)
+        _get_forces,
+    const std::vector<std::string> &_fields = {})
 {
   MPI_Comm comm, junk_comm;
   uintmax_t num_registered = 0;
   MPI_Init(NULL, NULL);
-  MPI_Comm_split(MPI_COMM_WORLD, 0, 0, &junk_comm);
+  // A color of its own keeps the controller out of the workers' comm
+  MPI_Comm_split(MPI_COMM_WORLD, 1, 0, &junk_comm);
   MPI_Comm_split(MPI_COMM_WORLD, 56789, 0, &comm);
   do {
     MPI_Status status;
     MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &status);
-    char *const buffer = new char[status._ucount + 1];
-    MPI_Recv(buffer, status._ucount, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, comm, &status);
-    buffer[status._ucount] = '\0';
-    boost::json::object json = boost::json::parse(buffer).as_object();
-    delete[] buffer;
+    boost::json::object json = decode_packet(receive_packet(status, comm), status.MPI_TAG, _fields);
     if (json["type"] == "register") {
-      json.clear();
-      json["type"] = "ack";
       ++num_registered;
-      std::stringstream s;
-      s << json;
-      auto raw = s.str();
+      auto raw = make_ack(json, _fields);
       MPI_Send(raw.c_str(), raw.size(), MPI_CHAR, status.MPI_SOURCE, 0, comm);
     } else if (json["type"] == "deregister") {
       --num_registered;
@@ -311,37 +765,84 @@ inline void ffield_controller(
       node_counts[0] = json_node_counts.at(0).as_int64();
       node_counts[1] = json_node_counts.at(1).as_int64();
       node_counts[2] = json_node_counts.at(2).as_int64();
-      json_to_send["nodes"] = boost::json::array();
+      // Workers may ask for a compressed binary grid instead of JSON
+      const bool compressed = json.contains("compression");
+      GridCompression compression;
+      if (compressed) {
+        const auto &request = json.at("compression").as_object();
+        if (request.at("encoding") == "float32") {
+          compression.encoding = ARBFN_GRID_FLOAT32;
+        } else if (request.at("encoding") == "fixed") {
+          compression.encoding = ARBFN_GRID_FIXED;
+        }
+        compression.tolerance = request.at("tolerance").to_number<double>();
+        compression.deflate = request.at("deflate").as_bool();
+      }
+
+      // Workers which allow it are sent one x-plane at a time, without indices
+      const bool chunks = json.contains("chunks") && json.at("chunks").as_bool();
+      const bool dense = json.contains("dense") && json.at("dense").as_bool();
+      const uint64_t total = (uint64_t) node_counts[0] * node_counts[1] * node_counts[2];
+      uint64_t first = 0;
+      std::vector<double> deltas;
+      const char *const list = dense ? "deltas" : "nodes";
+      json_to_send[list] = boost::json::array();
 
       bool first_flag = true;
       for (uint x_bin = 0; x_bin < node_counts[0]; ++x_bin) {
         for (uint y_bin = 0; y_bin < node_counts[1]; ++y_bin) {
           for (uint z_bin = 0; z_bin < node_counts[2]; ++z_bin) {
-            boost::json::object to_append;
             double pos[3];
             pos[0] = start[0] + binwidths[0] * x_bin;
             pos[1] = start[1] + binwidths[1] * y_bin;
             pos[2] = start[2] + binwidths[2] * z_bin;
-            to_append["xIndex"] = x_bin;
-            to_append["yIndex"] = y_bin;
-            to_append["zIndex"] = z_bin;
             double forces[3];
             forces[0] = forces[1] = forces[2] = 0.0;
 
             _get_forces(json["atoms"], first_flag, pos, forces);
             first_flag = false;
 
+            if (compressed) {
+              deltas.insert(deltas.end(), forces, forces + 3);
+              continue;
+            } else if (dense) {
+              auto &to_append = json_to_send.at(list).as_array();
+              to_append.push_back(forces[0]);
+              to_append.push_back(forces[1]);
+              to_append.push_back(forces[2]);
+              continue;
+            }
+
+            boost::json::object to_append;
+            to_append["xIndex"] = x_bin;
+            to_append["yIndex"] = y_bin;
+            to_append["zIndex"] = z_bin;
             to_append["dfx"] = forces[0];
             to_append["dfy"] = forces[1];
             to_append["dfz"] = forces[2];
             json_to_send.at("nodes").as_array().push_back(to_append);
           }
         }
+
+        const bool last = x_bin + 1 == (uint) node_counts[0];
+        if (!chunks && !last) { continue; }
+
+        if (compressed) {
+          std::vector<char> raw;
+          encode_grid(deltas, compression, -1, first, total, raw);
+          MPI_Send(raw.data(), raw.size(), MPI_BYTE, status.MPI_SOURCE, ARBFN_BINARY_TAG, comm);
+          first += deltas.size() / 3;
+          deltas.clear();
+          continue;
+        }
+
+        if (chunks) { json_to_send["more"] = !last; }
+        std::stringstream s;
+        s << json_to_send;
+        auto raw = s.str();
+        MPI_Send(raw.c_str(), raw.size(), MPI_CHAR, status.MPI_SOURCE, 0, comm);
+        json_to_send[list] = boost::json::array();
       }
-      std::stringstream s;
-      s << json_to_send;
-      auto raw = s.str();
-      MPI_Send(raw.c_str(), raw.size(), MPI_CHAR, status.MPI_SOURCE, 0, comm);
     }
   } while (num_registered != 0);
   MPI_Barrier(MPI_COMM_WORLD);
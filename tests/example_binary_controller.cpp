@@ -0,0 +1,35 @@
+/*
+A C++ example controller built on `controller.hpp`. Workers
+which offer the binary wire format during registration will be
+answered in it, while all others fall back to JSON: The atom
+callback below sees the same JSON object either way. It only
+asks for positions and forces, so velocities are never sent,
+and asks `fix arbfn` to only call it every other step.
+
+This is an edge repulsion system (NOT an edge dampening system).
+*/
+
+#include "controller.hpp"
+#include <cmath>
+
+static_assert(__cplusplus >= 201100ULL, "Invalid MPICXX version!");
+
+int main()
+{
+  independent_controller(
+      [](const boost::json::object &atom, double &dfx, double &dfy, double &dfz) {
+        const double x = atom.at("x").as_double();
+        const double y = atom.at("y").as_double();
+        const double fx = atom.at("fx").as_double();
+        const double fy = atom.at("fy").as_double();
+
+        // Edge repulsion
+        dfx = pow(x - 10.0, -7) + pow(x + 10.0, -7);
+        dfy = pow(y - 10.0, -7) + pow(y + 10.0, -7);
+        dfx = (dfx < 0.0 ? -1.0 : 1.0) * fmin(fabs(dfx), fmax(0.1, 1.5 * fabs(fx)));
+        dfy = (dfy < 0.0 ? -1.0 : 1.0) * fmin(fabs(dfy), fmax(0.1, 1.5 * fabs(fy)));
+        dfz = 0.0;
+      },
+      10000, {"x", "f"}, 2);
+  return 0;
+}
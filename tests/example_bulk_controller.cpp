@@ -15,6 +15,7 @@ This specific controller mimics gravity.
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <iostream>
 #include <map>
 #include <mpi.h>
@@ -31,7 +32,8 @@ int main()
 {
   MPI_Comm comm, junk_comm;
   MPI_Init(NULL, NULL);
-  MPI_Comm_split(MPI_COMM_WORLD, 0, 0, &junk_comm);
+  // A color of its own keeps the controller out of the workers' comm
+  MPI_Comm_split(MPI_COMM_WORLD, 1, 0, &junk_comm);
   MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, 0, &comm);
 
   std::cerr << __FILE__ << ":" << __LINE__ << "> "
@@ -42,9 +44,11 @@ int main()
   uintmax_t requests = 0;
   uintmax_t num_registered = 0;
 
-  // Bulk controlling: Maps worker rank to atom data
-  // Cleared after every successful step
-  std::map<int, boost::json::array> bulk_received;
+  // Bulk controlling: Maps worker rank to atom data, oldest
+  // request first. Workers may send several requests before
+  // reading any response (EG `fix arbfn ... lag 2`)
+  std::map<int, std::deque<boost::json::array>> bulk_received;
+  uintmax_t num_ready = 0;
 
   do {
     // Await some packet
@@ -73,8 +77,10 @@ int main()
     // Data processing
     else if (json["type"] == "request") {
       // Synchronization stuff
-      bulk_received[status.MPI_SOURCE] = json.at("atoms").as_array();
-      if (bulk_received.size() != num_registered) {
+      auto &queue = bulk_received[status.MPI_SOURCE];
+      queue.push_back(json.at("atoms").as_array());
+      if (queue.size() == 1) { ++num_ready; }
+      if (num_ready != num_registered) {
         // Send waiting packet and continue
         const std::string msg = "{\"type\": \"waiting\"}";
         MPI_Send(msg.c_str(), msg.size(), MPI_CHAR, status.MPI_SOURCE, 0, comm);
@@ -87,7 +93,7 @@ int main()
       double mean_x = 0.0, mean_y = 0.0;
       uintmax_t count = 0;
       for (const auto &p : bulk_received) {
-        for (const auto &item : p.second) {
+        for (const auto &item : p.second.front()) {
           ++count;
           mean_x += item.at("x").as_double();
           mean_y += item.at("y").as_double();
@@ -98,7 +104,7 @@ int main()
 
       for (const auto &p : bulk_received) {
         boost::json::array list;
-        for (const auto &item : p.second) {
+        for (const auto &item : p.second.front()) {
           const double dx = mean_x - item.at("x").as_double();
           const double dy = mean_y - item.at("y").as_double();
           const double distance = sqrt(pow(dx, 2) + pow(dy, 2));
@@ -126,7 +132,16 @@ int main()
         MPI_Send(raw.c_str(), raw.size(), MPI_CHAR, p.first, 0, comm);
       }
 
-      bulk_received.clear();
+      // Each worker's oldest request has been answered
+      num_ready = 0;
+      for (auto it = bulk_received.begin(); it != bulk_received.end();) {
+        it->second.pop_front();
+        if (it->second.empty()) {
+          it = bulk_received.erase(it);
+        } else {
+          ++num_ready, ++it;
+        }
+      }
     }
   } while (num_registered != 0);
 
@@ -0,0 +1,49 @@
+/*
+A C++ example bulk controller built on `controller.hpp`. Every
+other rank is a worker, so if they all offer it during
+registration, requests and responses are exchanged through
+collectives over the ARBFN communicator instead of packets, and
+no worker is ever sent a "waiting" packet.
+
+This specific controller mimics gravity, as does
+`example_bulk_controller.cpp`.
+*/
+
+#include "controller.hpp"
+#include <cmath>
+
+static_assert(__cplusplus >= 201100ULL, "Invalid MPICXX version!");
+
+int main()
+{
+  std::vector<double> xs, ys;
+  double mean_x = 0.0, mean_y = 0.0;
+
+  dependent_controller(
+      [&](const boost::json::array &atoms) {
+        // Find midpoint
+        xs.clear();
+        ys.clear();
+        mean_x = mean_y = 0.0;
+        for (const auto &item : atoms) {
+          xs.push_back(item.at("x").as_double());
+          ys.push_back(item.at("y").as_double());
+          mean_x += xs.back();
+          mean_y += ys.back();
+        }
+        mean_x /= fmax(1.0, xs.size());
+        mean_y /= fmax(1.0, ys.size());
+        return true;
+      },
+      [&](const uint64_t &index, double &dfx, double &dfy, double &dfz) {
+        const double dx = mean_x - xs[index];
+        const double dy = mean_y - ys[index];
+        const double distance = fmax(1e-9, sqrt(pow(dx, 2) + pow(dy, 2)));
+
+        dfx = fmin(fmax(dx / distance, -0.1), 0.1);
+        dfy = fmin(fmax(dy / distance, -0.1), 0.1);
+        dfz = 0.0;
+      },
+      10000, {"x"}, true);
+  return 0;
+}
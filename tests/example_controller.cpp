@@ -49,8 +49,9 @@ int main()
   // Initialize MPI subsystem
   MPI_Init(NULL, NULL);
 
-  // Comm split 1 (LAMMPS internal: junk_comm is useless)
-  MPI_Comm_split(MPI_COMM_WORLD, 0, 0, &junk_comm);
+  // Comm split 1 (LAMMPS internal: junk_comm is useless). A color of its own keeps the
+  // controller out of the workers' comm.
+  MPI_Comm_split(MPI_COMM_WORLD, 1, 0, &junk_comm);
 
   // Comm split 2 (ARBFN alignment: Produced real comm)
   MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, 0, &comm);
@@ -28,7 +28,8 @@ int main()
   MPI_Comm comm, junk_comm;
   uintmax_t num_registered = 0;
   MPI_Init(NULL, NULL);
-  MPI_Comm_split(MPI_COMM_WORLD, 0, 0, &junk_comm);
+  // A color of its own keeps the controller out of the workers' comm
+  MPI_Comm_split(MPI_COMM_WORLD, 1, 0, &junk_comm);
   MPI_Comm_split(MPI_COMM_WORLD, 56789, 0, &comm);
 
   MPI_Request ibarrier_request;
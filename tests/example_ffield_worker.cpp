@@ -0,0 +1,227 @@
+/*
+An ffield worker which asks the controller for the same grid
+once per supported encoding, checking that every node
+decodes to within the expected error. Then, as with
+`shared node`, only one rank per node fetches the grid into
+shared memory, which the others read in place. Used with
+`example_grid_controller.cpp`.
+*/
+
+#include "../ARBFN/grid_codec.h"
+#include "../ARBFN/interchange.h"
+#include "../ARBFN/interpolation.h"
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <mpi.h>
+#include <vector>
+
+const static unsigned int node_counts[3] = {21, 31, 11};
+const static double start[3] = {-10.0, -15.0, -5.0};
+const static double spacing[3] = {1.0, 1.0, 1.0};
+
+int main()
+{
+  uint controller_rank;
+  Handshake handshake;
+  MPI_Comm comm, junk_comm;
+
+  MPI_Init(NULL, NULL);
+  MPI_Comm_split(MPI_COMM_WORLD, 0, 0, &junk_comm);
+  MPI_Comm_split(MPI_COMM_WORLD, ARBFN_MPI_COLOR, 0, &comm);
+
+  const bool res = send_registration(controller_rank, comm, handshake, junk_comm);
+  assert(res);
+
+  // Allocate the nodes just as `fix arbfn/ffield` does
+  NodeGrid nodes;
+  nodes.allocate(node_counts);
+
+  // No compression (dense and indexed JSON), then each binary encoding
+  std::vector<GridCompression> modes(4);
+  modes[1].dense = false;
+  modes[2].encoding = ARBFN_GRID_FLOAT32;
+  modes[3].encoding = ARBFN_GRID_FIXED;
+  modes[3].tolerance = 1e-4;
+  if (ARBFN_HAS_ZLIB) {
+    modes.push_back(modes[3]);
+    modes.back().deflate = true;
+  }
+
+  // So fine that z (up to 1000) no longer fits in an int32, and falls back on doubles alone
+  modes.push_back(modes[3]);
+  modes.back().tolerance = 1e-7;
+
+  // Each fixed point axis gets the narrowest integer that fits it: At 1e-4, x and y (up to 1
+  // and 0.15) fit in int16s, but z needs an int32
+  {
+    std::vector<double> deltas;
+    for (int i = 0; i < 10; ++i) { deltas.insert(deltas.end(), {sin(i), 0.015 * i, 100.0 * i}); }
+    std::vector<char> packet;
+    encode_grid(deltas, modes[3], -1, 0, 10, packet);
+    GridHeader header;
+    std::string error;
+    size_t decoded = 0;
+    const bool ok = decode_grid(
+        packet.data(), packet.size(), header,
+        [&](const uint64_t &_index, const double &_dfx, const double &_dfy, const double &_dfz) {
+          assert(fabs(_dfx - deltas[3 * _index]) <= modes[3].tolerance);
+          assert(fabs(_dfy - deltas[3 * _index + 1]) <= modes[3].tolerance);
+          assert(fabs(_dfz - deltas[3 * _index + 2]) <= modes[3].tolerance);
+          ++decoded;
+        },
+        error);
+    assert(ok && decoded == 10);
+    assert(header.width[0] == 2 && header.width[1] == 2 && header.width[2] == 4);
+    assert(packet.size() == sizeof(header) + 10 * (2 + 2 + 4));
+  }
+
+  // The largest difference between any node and the controller's field
+  const auto max_error = [](const NodeGrid &_nodes) {
+    double worst = 0.0;
+    for (uint x = 0; x < node_counts[0]; ++x) {
+      for (uint y = 0; y < node_counts[1]; ++y) {
+        for (uint z = 0; z < node_counts[2]; ++z) {
+          const double pos[3] = {start[0] + x * spacing[0], start[1] + y * spacing[1],
+                                 start[2] + z * spacing[2]};
+          const double *const node = _nodes.at(x, y, z);
+          worst = fmax(worst, fabs(node[0] - sin(pos[0] / 7.0)));
+          worst = fmax(worst, fabs(node[1] - 0.01 * pos[1]));
+          worst = fmax(worst, fabs(node[2] - cos(pos[2]) * 1000.0));
+        }
+      }
+    }
+    return worst;
+  };
+
+  for (const auto &mode : modes) {
+    nodes.clear();
+
+    uintmax_t every = 0;
+    const bool got =
+        ffield_interchange(start, spacing, node_counts, controller_rank, comm, every, 0,
+                           std::vector<AtomColumn>(), mode, nodes, ARBFN_WAIT_BLOCK);
+    assert(got);
+
+    // float32 keeps about 7 significant digits, and the largest delta is 1000
+    const double tolerance = mode.encoding == ARBFN_GRID_FLOAT32 ? 1e-3 : mode.tolerance + 1e-12;
+    const double worst = max_error(nodes);
+
+    std::cout << __FILE__ << ":" << __LINE__ << "> "
+              << "Grid w/ encoding " << grid_encoding_name(mode.encoding)
+              << (mode.deflate ? " (deflated)" : "") << (mode.dense ? "" : " (indexed)")
+              << " has max error " << worst << "\n";
+    assert(worst <= tolerance);
+
+    // The ghosts continue the edge bins, so a corner far outside the grid extrapolates linearly.
+    // Each delta only varies along its own axis, so only that axis' edge bin matters
+    const double outside[3] = {start[0] - 5.0, start[1] + 100.0, start[2] - 0.5};
+    double far[3];
+    interpolate(far, outside, start, nodes, spacing);
+    const long top = node_counts[1] - 1;
+    const double *const low = nodes.at(0, 0, 0), *const high = nodes.at(0, top, 0);
+    const double expected[3] = {
+        low[0] - 5.0 * (nodes.at(1, 0, 0)[0] - low[0]),
+        high[1] + (100.0 - top) * (high[1] - nodes.at(0, top - 1, 0)[1]),
+        low[2] - 0.5 * (nodes.at(0, 0, 1)[2] - low[2])};
+    for (int i = 0; i < 3; ++i) {
+      assert(fabs(far[i] - expected[i]) <= 1e-9 * (1.0 + fabs(expected[i])));
+    }
+  }
+
+  // Nodes which move after a refresh keep it where they overlap, as `fix arbfn/ffield` does when
+  // load balancing moves a rank's subdomain. Refreshes add the field again here.
+  {
+    const unsigned int before_first[3] = {0, 0, 0}, before_counts[3] = {11, 16, 11};
+    const unsigned int after_first[3] = {5, 10, 0}, after_counts[3] = {11, 16, 11};
+    const auto fetch = [&](NodeGrid &_grid, const unsigned int _first[3]) {
+      const double offset[3] = {start[0] + _first[0] * spacing[0],
+                                start[1] + _first[1] * spacing[1],
+                                start[2] + _first[2] * spacing[2]};
+      uintmax_t every = 0;
+      const bool got =
+          ffield_interchange(offset, spacing, _grid.node_counts(), controller_rank, comm, every, 0,
+                             std::vector<AtomColumn>(), modes[0], _grid, ARBFN_WAIT_BLOCK);
+      assert(got);
+    };
+
+    NodeGrid before, after;
+    before.allocate(before_counts);
+    fetch(before, before_first);
+    fetch(before, before_first);
+    after.allocate(after_counts);
+    fetch(after, after_first);
+
+    const size_t kept = copy_overlap(after, after_first, before, before_first);
+    assert(kept == 6 * 6 * 11);
+    for (uint x = 0; x < after_counts[0]; ++x) {
+      for (uint y = 0; y < after_counts[1]; ++y) {
+        for (uint z = 0; z < after_counts[2]; ++z) {
+          const double pos[3] = {start[0] + (after_first[0] + x) * spacing[0],
+                                 start[1] + (after_first[1] + y) * spacing[1],
+                                 start[2] + (after_first[2] + z) * spacing[2]};
+          const double times = after_first[0] + x < 11 && after_first[1] + y < 16 ? 2.0 : 1.0;
+          const double *const node = after.at(x, y, z);
+          assert(fabs(node[0] - times * sin(pos[0] / 7.0)) <= 1e-12);
+          assert(fabs(node[1] - times * 0.01 * pos[1]) <= 1e-12);
+          assert(fabs(node[2] - times * cos(pos[2]) * 1000.0) <= 1e-9);
+        }
+      }
+    }
+
+    // The ghosts follow the copied nodes
+    const double *const ghost = after.at(-1, 0, 0);
+    for (int k = 0; k < 3; ++k) {
+      assert(fabs(ghost[k] - (2.0 * after.at(0, 0, 0)[k] - after.at(1, 0, 0)[k])) <= 1e-9);
+    }
+    std::cout << __FILE__ << ":" << __LINE__ << "> "
+              << "Moved grid kept its refresh on " << kept << " nodes\n";
+  }
+
+  // One grid per node, allocated by its leader
+  MPI_Comm node;
+  MPI_Win window;
+  int node_rank;
+  MPI_Comm_split_type(junk_comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+  MPI_Comm_rank(node, &node_rank);
+  const MPI_Aint bytes = node_rank == 0 ? NodeGrid::size_for(node_counts) * sizeof(double) : 0;
+  double *block = nullptr;
+  MPI_Win_allocate_shared(bytes, sizeof(double), MPI_INFO_NULL, node, &block, &window);
+
+  MPI_Aint size;
+  int unit;
+  MPI_Win_shared_query(window, 0, &size, &unit, &block);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+  NodeGrid shared;
+  shared.attach(node_counts, block);
+
+  // Only the leader asks for it
+  if (node_rank == 0) {
+    shared.clear();
+    uintmax_t every = 0;
+    const bool got =
+        ffield_interchange(start, spacing, node_counts, controller_rank, comm, every, 0,
+                           std::vector<AtomColumn>(), modes[0], shared, ARBFN_WAIT_BLOCK);
+    assert(got);
+  }
+  MPI_Win_sync(window);
+  MPI_Barrier(node);
+  MPI_Win_sync(window);
+
+  std::cout << __FILE__ << ":" << __LINE__ << "> "
+            << "Shared grid read by node rank " << node_rank << " has max error "
+            << max_error(shared) << "\n";
+  assert(max_error(shared) <= 1e-12);
+
+  MPI_Win_unlock_all(window);
+  MPI_Win_free(&window);
+  MPI_Comm_free(&node);
+
+  send_deregistration(controller_rank, comm);
+  MPI_Barrier(MPI_COMM_WORLD);
+  MPI_Comm_free(&comm);
+  MPI_Comm_free(&junk_comm);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,22 @@
+/*
+A C++ ffield controller built on `controller.hpp`, serving a
+smooth analytic force field. Workers which ask for a compressed
+grid get a binary one, and all others get JSON. Used with
+`example_ffield_worker.cpp`, which checks every node it gets.
+*/
+
+#include "controller.hpp"
+#include <cmath>
+
+static_assert(__cplusplus >= 201100ULL, "Invalid MPICXX version!");
+
+int main()
+{
+  ffield_controller(
+      [](const boost::json::value &, const bool &, const double pos[3], double forces[3]) {
+        forces[0] = sin(pos[0] / 7.0);
+        forces[1] = 0.01 * pos[1];
+        forces[2] = cos(pos[2]) * 1000.0;
+      });
+  return 0;
+}
@@ -2,16 +2,35 @@
 
 #include <cassert>
 #include <cstddef>
+#include <cstdlib>
+#include <deque>
 #include <iostream>
 #include <mpi.h>
+#include <new>
 #include <random>
 #include <vector>
 
 const static size_t num_updates = 1000;
+const static size_t num_lagged_updates = 100;
+const static size_t lag = 2;
+const static size_t num_persistent_updates = 100;
 const static size_t num_atoms = 128;
 const static double dt = 0.01;
 const static double max_ms = 50.0;
 
+/// The number of heap allocations so far, to check that steady-state interchange makes none
+static size_t allocations = 0;
+
+void *operator new(size_t _size)
+{
+  ++allocations;
+  void *const out = malloc(_size);
+  if (out == nullptr) { throw std::bad_alloc(); }
+  return out;
+}
+
+void operator delete(void *_ptr) noexcept { free(_ptr); }
+
 int main()
 {
   std::uniform_real_distribution<double> dist(-100.0, 100.0);
@@ -19,6 +38,7 @@ int main()
   std::random_device rng;
   std::vector<AtomData> atoms;
   uint controller_rank;
+  Handshake handshake;
   MPI_Comm comm, junk_comm;
 
   MPI_Init(NULL, NULL);
@@ -52,14 +72,24 @@ int main()
     atoms.push_back(cur);
   }
 
-  const bool res = send_registration(controller_rank, comm);
+  // With several controllers, each takes a contiguous block of workers. With one, it may pick
+  // the collective mode.
+  int worker_rank, num_workers;
+  MPI_Comm_rank(junk_comm, &worker_rank);
+  MPI_Comm_size(junk_comm, &num_workers);
+  const bool res = send_registration(controller_rank, comm, handshake, junk_comm,
+                                     (double) worker_rank / num_workers, true);
   assert(res);
 
   int my_rank;
   MPI_Comm_rank(comm, &my_rank);
 
   std::cout << __FILE__ << ":" << __LINE__ << "> "
-            << "Got controller rank " << controller_rank << '\n';
+            << "Got controller rank " << controller_rank << " using "
+            << (handshake.collective                   ? "collective"
+                : handshake.format == ARBFN_FORMAT_BINARY ? "binary"
+                                                          : "JSON")
+            << " packets\n";
 
   std::cout << __FILE__ << ":" << __LINE__ << "> "
             << "Worker with rank " << my_rank << " launched\n";
@@ -84,9 +114,10 @@ int main()
       atom_info_send[j] = atoms[j];
     }
 
-    // Interchange
-    const bool res =
-        interchange(n, atom_info_send.data(), fix_info_recv.data(), max_ms, controller_rank, comm);
+    // Interchange, cycling through every way of waiting
+    const WaitMode wait = (WaitMode) (step % 4);
+    const bool res = interchange(n, atom_info_send.data(), fix_info_recv.data(), max_ms,
+                                 controller_rank, comm, handshake, wait);
     assert(res);
 
     if (step % 10 == 0) {
@@ -102,7 +133,105 @@ int main()
     }
   }
 
-  send_deregistration(controller_rank, comm);
+  // Then lagged: Each response is only collected `lag` steps after its request was posted
+  std::vector<std::string> fields = handshake.fields;
+  if (fields.empty()) { fields = default_fields(false); }
+  sort_fields(fields);
+
+  std::vector<AtomColumn> columns;
+  for (const auto &field : fields) { columns.push_back(make_column(field)); }
+
+  // Copies the atoms into the columns. AtomData interleaves x, vx, fx, y, ...
+  const auto stage = [&]() {
+    for (auto &column : columns) {
+      const int offset = column.field == ARBFN_FIELD_X ? 0
+          : column.field == ARBFN_FIELD_V              ? 1
+          : column.field == ARBFN_FIELD_F              ? 2
+                                                       : -1;
+      column.values.assign(n * column.width, 0.0);
+      for (size_t j = 0; offset >= 0 && j < n; ++j) {
+        for (uint k = 0; k < column.width; ++k) {
+          column.values[j * column.width + k] = (&atoms[j].x)[offset + 3 * k];
+        }
+      }
+    }
+  };
+
+  std::deque<PendingRequest> in_flight;
+  std::vector<double> deltas;
+  uintmax_t every = 0;
+  // Collectives cannot be pipelined
+  for (size_t step = 0; !handshake.collective && step < num_lagged_updates + lag; ++step) {
+    if (step < num_lagged_updates) {
+      stage();
+      in_flight.emplace_back();
+      post_request(n, columns, max_ms, controller_rank, comm, handshake, in_flight.back());
+    }
+
+    if (step < lag) { continue; }
+
+    deltas.resize(3 * n);
+    const bool res = collect_response(in_flight.front(), deltas.data(), max_ms, controller_rank,
+                                      comm, handshake);
+    assert(res);
+
+    // A controller which sets `every` should do so consistently
+    assert(step == lag || in_flight.front().every == every);
+    every = in_flight.front().every;
+    in_flight.pop_front();
+
+    for (size_t j = 0; j < n; ++j) {
+      atoms[j].fx += deltas[j];
+      atoms[j].fy += deltas[n + j];
+      atoms[j].fz += deltas[2 * n + j];
+    }
+  }
+  assert(in_flight.empty());
+
+  std::cout << __FILE__ << ":" << __LINE__ << "> "
+            << "Worker " << my_rank << " got " << num_lagged_updates << " lagged responses\n";
+
+  // Finally through persistent requests, with the atom count changing part way through. Once
+  // that has settled, the last quarter of the steps must not allocate at all.
+  PersistentExchange exchange;
+  std::vector<uint64_t> offsets;
+  size_t steady_allocations = 0;
+  for (size_t step = 0; step < num_persistent_updates; ++step) {
+    const size_t m = step < num_persistent_updates / 2 ? n : n / 2;
+    if (step == 3 * num_persistent_updates / 4) { steady_allocations = allocations; }
+    stage();
+    deltas.resize(3 * m);
+
+    // Every other request poses as one aggregated from two ranks
+    offsets.clear();
+    if (step % 2 == 1) {
+      offsets.push_back(0);
+      offsets.push_back(m / 2);
+    }
+
+    const bool res = persistent_interchange(m, columns, deltas.data(), max_ms, controller_rank,
+                                            comm, handshake, exchange, ARBFN_WAIT_SLEEP, offsets);
+    assert(res);
+
+    for (size_t j = 0; j < m; ++j) {
+      atoms[j].fx += deltas[j];
+      atoms[j].fy += deltas[m + j];
+      atoms[j].fz += deltas[2 * m + j];
+    }
+  }
+  steady_allocations = allocations - steady_allocations;
+  free_exchange(exchange);
+
+  // Collective responses cannot set `every`
+  assert(handshake.collective ? exchange.every == 0 : exchange.every == every);
+
+  std::cout << __FILE__ << ":" << __LINE__ << "> "
+            << "Worker " << my_rank << " got " << num_persistent_updates
+            << " persistent responses (every " << exchange.every << ", "
+            << steady_allocations << " steady-state allocations)\n";
+  assert(steady_allocations == 0);
+
+  send_deregistration(controller_rank, comm, handshake);
 
   // Final sync
   MPI_Barrier(MPI_COMM_WORLD);
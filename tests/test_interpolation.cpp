@@ -2,6 +2,7 @@
 #include <cassert>
 #include <cmath>
 #include <iostream>
+#include <vector>
 
 void assert_approx_eq(const double &_l, const double &_r, const double &_eps = 0.01)
 {
@@ -69,5 +70,215 @@ int main()
   assert_approx_eq(out[1], exp_val[1]);
   assert_approx_eq(out[2], exp_val[2]);
 
+  // A linear field is reproduced exactly by trilinear interpolation on a grid
+  const unsigned int node_counts[3] = {5, 4, 3};
+  const double start[3] = {-1.0, 2.0, 0.5};
+  const auto field = [](const double _pos[3], double _into[3]) {
+    _into[0] = 2.0 * _pos[0] - _pos[1] + 0.5 * _pos[2];
+    _into[1] = _pos[1] + 3.0;
+    _into[2] = -4.0 * _pos[2] + _pos[0];
+  };
+
+  NodeGrid grid;
+  grid.allocate(node_counts);
+  for (unsigned int x = 0; x < node_counts[0]; ++x) {
+    for (unsigned int y = 0; y < node_counts[1]; ++y) {
+      for (unsigned int z = 0; z < node_counts[2]; ++z) {
+        const double node_pos[3] = {start[0] + x * bin_deltas[0], start[1] + y * bin_deltas[1],
+                                    start[2] + z * bin_deltas[2]};
+        field(node_pos, grid.at(x, y, z));
+      }
+    }
+  }
+  grid.fill_ghosts();
+
+  const double inside[][3] = {{0.0, 3.0, 1.0}, {12.5, 41.0, 150.0}, {39.0, 61.9, 200.5}};
+  for (const auto &point : inside) {
+    field(point, exp_val);
+    interpolate(out, point, start, grid, bin_deltas);
+    assert_approx_eq(out[0], exp_val[0], 1e-9);
+    assert_approx_eq(out[1], exp_val[1], 1e-9);
+    assert_approx_eq(out[2], exp_val[2], 1e-9);
+  }
+
+  // Past the edges, the ghosts continue the field in a straight line
+  const double outside[3] = {-50.0, 2.0 + 3 * bin_deltas[1] + 7.0, 0.5 + bin_deltas[2]};
+  field(outside, exp_val);
+  interpolate(out, outside, start, grid, bin_deltas);
+  assert_approx_eq(out[0], exp_val[0], 1e-9);
+  assert_approx_eq(out[1], exp_val[1], 1e-9);
+  assert_approx_eq(out[2], exp_val[2], 1e-9);
+
+  // The batched kernel must match the scalar path, inside the grid and out, for any remainder
+  const double extent[3] = {node_counts[0] * bin_deltas[0], node_counts[1] * bin_deltas[1],
+                            node_counts[2] * bin_deltas[2]};
+  const size_t n = 37;
+  std::vector<double> positions(3 * (n + 5)), batch(3 * n), scalar(3 * n);
+  std::vector<int> indices(n);
+  for (size_t i = 0; i < positions.size(); ++i) {
+    // Deterministic, but scattered over the grid and a little past it
+    const double t = fmod(i * 0.6180339887498949, 1.0);
+    positions[i] = start[i % 3] + (1.2 * t - 0.1) * extent[i % 3];
+  }
+  for (size_t j = 0; j < n; ++j) { indices[j] = (int) ((j * 7) % (n + 5)); }
+
+  std::cout << "Checking the " << ARBFN_SIMD_NAME << " batched kernel\n";
+  for (const int *const which : {(const int *) nullptr, (const int *) indices.data()}) {
+    interpolate_batch(n, positions.data(), which, batch.data(), start, grid, bin_deltas);
+    for (size_t j = 0; j < n; ++j) {
+      const size_t i = which != nullptr ? which[j] : j;
+      interpolate(scalar.data() + 3 * j, positions.data() + 3 * i, start, grid, bin_deltas);
+      for (int k = 0; k < 3; ++k) {
+        const double expected = scalar[3 * j + k];
+        assert_approx_eq(batch[3 * j + k], expected, 1e-12 * (1.0 + fabs(expected)));
+      }
+    }
+  }
+
+  // A subdomain's nodes, plus a ghost bin each way, give the same deltas there as the whole grid
+  const unsigned int wide_counts[3] = {16, 9, 3};
+  NodeGrid wide;
+  wide.allocate(wide_counts);
+  for (unsigned int x = 0; x < wide_counts[0]; ++x) {
+    for (unsigned int y = 0; y < wide_counts[1]; ++y) {
+      for (unsigned int z = 0; z < wide_counts[2]; ++z) {
+        const double node_pos[3] = {start[0] + x * bin_deltas[0], start[1] + y * bin_deltas[1],
+                                    start[2] + z * bin_deltas[2]};
+        field(node_pos, wide.at(x, y, z));
+      }
+    }
+  }
+  wide.fill_ghosts();
+
+  const double sublo[3] = {start[0] + 4.2 * bin_deltas[0], start[1] - 1.0,
+                           start[2] + 0.2 * bin_deltas[2]};
+  const double subhi[3] = {start[0] + 5.1 * bin_deltas[0], start[1] + 1.2 * bin_deltas[1],
+                           start[2] + 0.9 * bin_deltas[2]};
+  const double ghosts[3] = {1.0, 1.0, 1.0};
+  unsigned int first[3], counts[3];
+  subdomain_nodes(first, counts, sublo, subhi, start, bin_deltas, wide_counts, ghosts);
+  assert(first[0] == 3 && counts[0] == 5);
+  assert(first[1] == 0 && counts[1] == 4);
+  assert(first[2] == 0 && counts[2] == 3);
+
+  // Just as a controller would send them for a gridRequest at the subdomain's first node
+  NodeGrid local;
+  local.allocate(counts);
+  double local_start[3];
+  for (int i = 0; i < 3; ++i) { local_start[i] = start[i] + first[i] * bin_deltas[i]; }
+  for (unsigned int x = 0; x < counts[0]; ++x) {
+    for (unsigned int y = 0; y < counts[1]; ++y) {
+      for (unsigned int z = 0; z < counts[2]; ++z) {
+        const double *const from = wide.at(first[0] + x, first[1] + y, first[2] + z);
+        std::copy(from, from + 3, local.at(x, y, z));
+      }
+    }
+  }
+  local.fill_ghosts();
+
+  for (int sample = 0; sample <= 100; ++sample) {
+    double point[3], expected[3];
+    for (int i = 0; i < 3; ++i) {
+      const double t = fmod((3 * sample + i) * 0.6180339887498949, 1.0);
+      point[i] = sublo[i] - bin_deltas[i] + t * (subhi[i] - sublo[i] + 2.0 * bin_deltas[i]);
+    }
+    interpolate(expected, point, start, wide, bin_deltas);
+    interpolate(out, point, local_start, local, bin_deltas);
+    assert_approx_eq(out[0], expected[0], 1e-9);
+    assert_approx_eq(out[1], expected[1], 1e-9);
+    assert_approx_eq(out[2], expected[2], 1e-9);
+  }
+
+  // The cubic kernels reproduce linear fields exactly too, up to the edges and past them
+  NodeGrid coefficients;
+  bspline_coefficients(coefficients, wide);
+  for (int sample = 0; sample <= 100; ++sample) {
+    double point[3], expected[3];
+    for (int i = 0; i < 3; ++i) {
+      const double t = fmod((3 * sample + i) * 0.7548776662466927, 1.0);
+      const double extent = (wide_counts[i] - 1) * bin_deltas[i];
+      point[i] = start[i] + (1.2 * t - 0.1) * extent;
+    }
+    field(point, expected);
+    interpolate_cubic(out, point, start, wide, bin_deltas, ARBFN_INTERP_CUBIC);
+    for (int i = 0; i < 3; ++i) { assert_approx_eq(out[i], expected[i], 1e-9); }
+    interpolate_cubic(out, point, start, coefficients, bin_deltas, ARBFN_INTERP_BSPLINE3);
+    for (int i = 0; i < 3; ++i) { assert_approx_eq(out[i], expected[i], 1e-9); }
+  }
+
+  // On a smooth field, the cubic kernels on a grid twice as coarse beat the linear one
+  const auto smooth = [](const double _pos[3], double _into[3]) {
+    _into[0] = sin(_pos[0]) * cos(0.5 * _pos[1]) + 0.3 * _pos[2] * _pos[2];
+    _into[1] = exp(-0.2 * _pos[0]) * sin(_pos[2]);
+    _into[2] = cos(_pos[0] + _pos[1] - _pos[2]);
+  };
+  const char *const kernel_names[3] = {"linear", "cubic", "bspline3"};
+  const unsigned int sides[4] = {9, 17, 33, 65};
+  const double origin[3] = {0.0, 0.0, 0.0};
+  double errors[3][4];
+
+  std::cout << "Max error away from the edges, by nodes per side:\n";
+  for (int r = 0; r < 4; ++r) {
+    const unsigned int counts[3] = {sides[r], sides[r], sides[r]};
+    const double width = 4.0 / (sides[r] - 1);
+    const double widths[3] = {width, width, width};
+    NodeGrid smooth_grid;
+    smooth_grid.allocate(counts);
+    for (unsigned int x = 0; x < counts[0]; ++x) {
+      for (unsigned int y = 0; y < counts[1]; ++y) {
+        for (unsigned int z = 0; z < counts[2]; ++z) {
+          const double node_pos[3] = {x * width, y * width, z * width};
+          smooth(node_pos, smooth_grid.at(x, y, z));
+        }
+      }
+    }
+    smooth_grid.fill_ghosts();
+    bspline_coefficients(coefficients, smooth_grid);
+
+    for (int k = 0; k < 3; ++k) { errors[k][r] = 0.0; }
+    for (int sample = 0; sample < 1000; ++sample) {
+      double point[3], expected[3], got[3][3];
+      for (int i = 0; i < 3; ++i) {
+        point[i] = 1.0 + 2.0 * fmod((3 * sample + i) * 0.6180339887498949, 1.0);
+      }
+      smooth(point, expected);
+      interpolate(got[0], point, origin, smooth_grid, widths);
+      interpolate_cubic(got[1], point, origin, smooth_grid, widths, ARBFN_INTERP_CUBIC);
+      interpolate_cubic(got[2], point, origin, coefficients, widths, ARBFN_INTERP_BSPLINE3);
+      for (int k = 0; k < 3; ++k) {
+        for (int i = 0; i < 3; ++i) {
+          errors[k][r] = fmax(errors[k][r], fabs(got[k][i] - expected[i]));
+        }
+      }
+    }
+
+    // Past the edges along every axis, all three extrapolate the edge bins alike
+    const double corners[3][3] = {{-0.7, -2.0, -0.3}, {4.5, 5.9, 7.0}, {-0.7, 5.9, -0.3}};
+    for (const auto &corner : corners) {
+      double got[3][3];
+      interpolate(got[0], corner, origin, smooth_grid, widths);
+      interpolate_cubic(got[1], corner, origin, smooth_grid, widths, ARBFN_INTERP_CUBIC);
+      interpolate_cubic(got[2], corner, origin, coefficients, widths, ARBFN_INTERP_BSPLINE3);
+      for (int i = 0; i < 3; ++i) {
+        assert_approx_eq(got[1][i], got[0][i], 1e-9);
+        assert_approx_eq(got[2][i], got[0][i], 1e-9);
+      }
+    }
+  }
+  for (int k = 0; k < 3; ++k) {
+    std::cout << "  " << kernel_names[k] << ":";
+    for (int r = 0; r < 4; ++r) { std::cout << " " << sides[r] << " -> " << errors[k][r]; }
+    std::cout << "\n";
+  }
+
+  for (int r = 0; r + 1 < 4; ++r) {
+    // Halving the spacing divides the error by roughly 4 (linear), 8 (cubic) or 16 (bspline3)
+    assert(errors[0][r] > 2.5 * errors[0][r + 1]);
+    assert(errors[1][r] > 5.0 * errors[1][r + 1]);
+    assert(errors[2][r] > 12.0 * errors[2][r + 1]);
+    assert(errors[1][r] < errors[0][r + 1]);
+    assert(errors[2][r] < errors[0][r + 1]);
+  }
+
   return 0;
 }
@@ -0,0 +1,92 @@
+/*
+Checks the Kokkos kernels of `fix arbfn/ffield/kk` on the host
+execution space (EG OpenMP): Interpolation against interpolate,
+and the group's extent against a plain loop.
+Build with `make test10 KOKKOS_PATH=...`.
+*/
+
+#include "../ARBFN/interpolation_kokkos.h"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+
+typedef Kokkos::DefaultHostExecutionSpace Space;
+
+int main(int argc, char **argv)
+{
+  Kokkos::ScopeGuard kokkos(argc, argv);
+
+  // A field trilinear interpolation can not reproduce exactly
+  const unsigned int node_counts[3] = {6, 5, 4};
+  const double start[3] = {-1.0, 2.0, 0.5};
+  const double bin_deltas[3] = {0.5, 0.25, 1.0};
+  NodeGrid grid;
+  grid.allocate(node_counts);
+  for (unsigned int x = 0; x < node_counts[0]; ++x) {
+    for (unsigned int y = 0; y < node_counts[1]; ++y) {
+      for (unsigned int z = 0; z < node_counts[2]; ++z) {
+        double *const node = grid.at(x, y, z);
+        node[0] = sin(0.7 * x + y);
+        node[1] = x * y - z;
+        node[2] = cos(0.3 * z) * x;
+      }
+    }
+  }
+  grid.fill_ghosts();
+
+  // Atoms scattered over the grid and a little past it, every other one in the group
+  const int n = 101, groupbit = 2;
+  Kokkos::View<double *[3], Kokkos::LayoutRight, Space> x("x", n), f("f", n);
+  Kokkos::View<int *, Space> mask("mask", n);
+  Kokkos::View<double *, Space> nodes("nodes", grid.size());
+  for (int i = 0; i < n; ++i) {
+    for (int k = 0; k < 3; ++k) {
+      const double t = fmod((3 * i + k) * 0.6180339887498949, 1.0);
+      x(i, k) = start[k] + (1.2 * t - 0.1) * (node_counts[k] - 1) * bin_deltas[k];
+      f(i, k) = 1.0;
+    }
+    mask(i) = i % 2 ? groupbit | 1 : 1;
+  }
+  for (size_t i = 0; i < grid.size(); ++i) { nodes(i) = grid.data()[i]; }
+
+  FFieldInterpolator<decltype(x), decltype(f), decltype(mask), decltype(nodes)> interpolator;
+  interpolator.describe(groupbit, start, bin_deltas, grid);
+  interpolator.x = x;
+  interpolator.f = f;
+  interpolator.mask = mask;
+  interpolator.nodes = nodes;
+  Kokkos::parallel_for(Kokkos::RangePolicy<Space>(0, n), interpolator);
+  Kokkos::fence();
+
+  for (int i = 0; i < n; ++i) {
+    double pos[3] = {x(i, 0), x(i, 1), x(i, 2)}, expected[3] = {0.0, 0.0, 0.0};
+    if (mask(i) & groupbit) { interpolate(expected, pos, start, grid, bin_deltas); }
+    for (int k = 0; k < 3; ++k) {
+      if (fabs(f(i, k) - (1.0 + expected[k])) > 1e-12 * (1.0 + fabs(expected[k]))) {
+        std::cout << "Error! Atom " << i << " has " << f(i, k) << " != " << 1.0 + expected[k]
+                  << '\n';
+      }
+      assert(fabs(f(i, k) - (1.0 + expected[k])) <= 1e-12 * (1.0 + fabs(expected[k])));
+    }
+  }
+
+  // The group's extent, as `fix arbfn/ffield/kk` checks its grid against
+  GroupExtent<decltype(x), decltype(mask)> extent;
+  extent.x = x;
+  extent.mask = mask;
+  extent.groupbit = groupbit;
+  decltype(extent)::value_type bounds;
+  Kokkos::parallel_reduce(Kokkos::RangePolicy<Space>(0, n), extent, bounds);
+  for (int k = 0; k < 3; ++k) {
+    double lo = HUGE_VAL, hi = -HUGE_VAL;
+    for (int i = 0; i < n; ++i) {
+      if (!(mask(i) & groupbit)) { continue; }
+      lo = fmin(lo, x(i, k));
+      hi = fmax(hi, x(i, k));
+    }
+    assert(bounds.lo[k] == lo && bounds.hi[k] == hi);
+  }
+
+  std::cout << "Kokkos kernel matches interpolate on " << Space::name() << '\n';
+  return 0;
+}